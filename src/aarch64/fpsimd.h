@@ -0,0 +1,13 @@
+#pragma once
+
+#include <common/defines.h>
+
+/* FP/SIMD register file of a user process. */
+typedef struct FpsimdState {
+    u64 q[64]; // q0-q31, 128 bits each
+    u64 fpcr;
+    u64 fpsr;
+} FpsimdState;
+
+void fpsimd_save(FpsimdState *state);
+void fpsimd_load(const FpsimdState *state);
@@ -88,6 +88,12 @@ static ALWAYS_INLINE void arch_dsb_sy()
     asm volatile("dsb sy" ::: "memory");
 }
 
+/* Order earlier stores before a following `sev`. */
+static ALWAYS_INLINE void arch_dsb_ishst()
+{
+    asm volatile("dsb ishst" ::: "memory");
+}
+
 static ALWAYS_INLINE void arch_fence()
 {
     arch_dsb_sy();
@@ -99,7 +105,7 @@ static ALWAYS_INLINE void arch_fence()
  * architectural barriers. This is because they are specifically
  * designed to access device memory regions, which are already marked as
  * nGnRnE (Non-Gathering, Non-Reordering, on-Early Write Acknowledgement)
- * in the `kernel_pt_level0`.
+ * in the kernel page table.
  */
 static ALWAYS_INLINE void device_put_u32(u64 addr, u32 value)
 {
@@ -160,6 +166,33 @@ static ALWAYS_INLINE void arch_tlbi_vmalle1is()
     arch_fence();
 }
 
+/* Flush TLB entries tagged with `asid`. */
+static ALWAYS_INLINE void arch_tlbi_aside1is(u64 asid)
+{
+    arch_fence();
+    asm volatile("tlbi aside1is, %[x]" : : [x] "r"(asid << 48));
+    arch_fence();
+}
+
+/**
+ * Flush the TLB entry of page `va` tagged with `asid`, without barriers.
+ * Callers issuing a batch put one `dsb` before and one after the batch.
+ */
+static ALWAYS_INLINE void arch_tlbi_vae1is_nosync(u64 asid, u64 va)
+{
+    asm volatile("tlbi vae1is, %[x]"
+                 :
+                 : [x] "r"((asid << 48) | ((va >> 12) & 0xFFFFFFFFFFFull)));
+}
+
+/* Flush the TLB entry of page `va` tagged with `asid`. */
+static ALWAYS_INLINE void arch_tlbi_vae1is(u64 asid, u64 va)
+{
+    arch_fence();
+    arch_tlbi_vae1is_nosync(asid, va);
+    arch_fence();
+}
+
 /* Set Translation Table Base Register 0 (EL1). */
 static ALWAYS_INLINE void arch_set_ttbr0(u64 addr)
 {
@@ -168,6 +201,17 @@ static ALWAYS_INLINE void arch_set_ttbr0(u64 addr)
     arch_tlbi_vmalle1is();
 }
 
+/**
+ * Set Translation Table Base Register 0 (EL1) together with the ASID.
+ * TLB entries of other ASIDs stay valid, so no flush is needed.
+ */
+static ALWAYS_INLINE void arch_set_ttbr0_asid(u64 addr, u64 asid)
+{
+    arch_fence();
+    asm volatile("msr ttbr0_el1, %[x]" : : [x] "r"((asid << 48) | addr));
+    arch_isb();
+}
+
 /* Get Translation Table Base Register 0 (EL1). */
 static inline u64 arch_get_ttbr0()
 {
@@ -186,6 +230,21 @@ static ALWAYS_INLINE void arch_set_ttbr1(u64 addr)
     arch_tlbi_vmalle1is();
 }
 
+/* CPACR_EL1.FPEN: trap FP/SIMD accesses from EL0 only, or from neither EL. */
+#define CPACR_FPEN_MASK (3 << 20)
+#define CPACR_FPEN_TRAP_EL0 (1 << 20)
+#define CPACR_FPEN_NO_TRAP (3 << 20)
+
+/* Set the FP/SIMD trap control in CPACR_EL1. */
+static ALWAYS_INLINE void arch_set_fpen(u64 fpen)
+{
+    u64 cpacr;
+    asm volatile("mrs %[x], cpacr_el1" : [x] "=r"(cpacr));
+    cpacr = (cpacr & ~CPACR_FPEN_MASK) | fpen;
+    asm volatile("msr cpacr_el1, %[x]" : : [x] "r"(cpacr));
+    arch_isb();
+}
+
 /* Read Fault Address Register. */
 static inline u64 arch_get_far()
 {
@@ -279,6 +338,17 @@ static ALWAYS_INLINE void set_cntv_tval_el0(u64 t)
     asm volatile("msr cntv_tval_el0, %0" : : "r"(t));
 }
 
+/* CNTKCTL_EL1.EL0VCTEN: let EL0 read CNTVCT_EL0 (and CNTFRQ_EL0). */
+#define CNTKCTL_EL0VCTEN (1 << 1)
+
+static ALWAYS_INLINE void arch_enable_el0_vct()
+{
+    u64 c;
+    asm volatile("mrs %0, cntkctl_el1" : "=r"(c));
+    asm volatile("msr cntkctl_el1, %0" : : "r"(c | CNTKCTL_EL0VCTEN));
+    arch_isb();
+}
+
 static inline bool _arch_enable_trap()
 {
     u64 t;
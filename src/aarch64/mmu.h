@@ -18,6 +18,9 @@ typedef unsigned long long u64;
 
 #define AF_USED (1 << 10)
 
+// not global: the TLB entry is tagged with the current ASID
+#define PTE_NG (1 << 11)
+
 #define PTE_NORMAL_NC ((MT_NORMAL_NC << 2) | AF_USED | SH_OUTER)
 #define PTE_NORMAL ((MT_NORMAL << 2) | AF_USED | SH_OUTER)
 #define PTE_DEVICE ((MT_DEVICE_nGnRnE << 2) | AF_USED)
@@ -27,6 +30,14 @@ typedef unsigned long long u64;
 #define PTE_TABLE 0x3
 #define PTE_BLOCK 0x1
 #define PTE_PAGE 0x3
+#define PTE_TYPE_MASK 0x3
+
+// a valid level-1/2 descriptor that maps a block instead of a table
+#define PTE_IS_BLOCK(pte) (((pte) & PTE_TYPE_MASK) == PTE_BLOCK)
+
+// memory covered by one block descriptor at level 1 and level 2
+#define L1_BLOCK_SIZE 0x40000000
+#define L2_BLOCK_SIZE 0x200000
 
 #define PTE_KERNEL (0 << 6)
 #define PTE_USER (1 << 6)
@@ -35,12 +46,29 @@ typedef unsigned long long u64;
 
 #define PTE_KERNEL_DATA (PTE_KERNEL | PTE_NORMAL | PTE_BLOCK)
 #define PTE_KERNEL_DEVICE (PTE_KERNEL | PTE_DEVICE | PTE_BLOCK)
-#define PTE_USER_DATA (PTE_USER | PTE_NORMAL | PTE_PAGE)
+#define PTE_USER_DATA (PTE_USER | PTE_NG | PTE_NORMAL | PTE_PAGE)
 
 #define N_PTE_PER_TABLE 512
 
+// TCR_EL1.AS = 0: 8-bit ASIDs, taken from TTBR0_EL1[55:48]
+#define ASID_BITS 8
+
 #define PTE_HIGH_NX (1LL << 54)
 
+// software-defined: read-only because the page is shared copy-on-write
+#define PTE_COW (1ULL << 55)
+
+// software-defined: the frame comes from a split block mapping, so it is
+// managed by whoever mapped the block and is not reference counted
+#define PTE_NOREF (1ULL << 56)
+
+// software-defined: the page is shared with the kernel (e.g. a syscall
+// ring) and must stay writable and shared across fork, never COW
+#define PTE_SHARED (1ULL << 57)
+
+// APTable[1] in a table descriptor: no write access at any lower level
+#define PTE_TABLE_RO (1ULL << 62)
+
 #define KSPACE_MASK 0xFFFF000000000000
 
 // convert kernel address into physical address.
@@ -69,3 +97,9 @@ typedef PTEntry *PTEntriesPtr;
 #define VA_PART1(va) (((u64)(va) & 0x7FC0000000) >> 30)
 #define VA_PART2(va) (((u64)(va) & 0x3FE00000) >> 21)
 #define VA_PART3(va) (((u64)(va) & 0x1FF000) >> 12)
+
+// index into the level-`level` table, same as VA_PART0..3
+#define VA_PART(va, level) (((u64)(va) >> (39 - 9 * (level))) & 0x1FF)
+
+// size of the region covered by one entry in a level-`level` table
+#define LEVEL_SIZE(level) (1ULL << (39 - 9 * (level)))
@@ -5,18 +5,21 @@
 #include <driver/interrupt.h>
 #include <kernel/proc.h>
 #include <kernel/syscall.h>
+#include <kernel/paging.h>
+#include <kernel/fpsimd.h>
 
+// trap.S的系统调用快速路径直接读取killed字段
+_Static_assert(__builtin_offsetof(Proc, killed) == 0,
+               "trap.S reads Proc.killed at offset 0");
+
+// ucontext固定在内核栈顶，只有从EL0陷入时的context才是它，这里不去改写
 void trap_global_handler(UserContext *context)
 {
-    thisproc()->ucontext = context;
-
     u64 esr = arch_get_esr();
     u64 ec = esr >> ESR_EC_SHIFT;
     u64 iss = esr & ESR_ISS_MASK;
     u64 ir = esr & ESR_IR_MASK;
 
-    (void)iss;
-
     arch_reset_esr();
 
     switch (ec) {
@@ -29,9 +32,20 @@ void trap_global_handler(UserContext *context)
     case ESR_EC_SVC64: {
         syscall_entry(context);
     } break;
+    case ESR_EC_FPSIMD: {
+        // 内核不使用FP/SIMD，只有用户进程会因第一次使用而陷入
+        if ((context->spsr & 0xf) != 0)
+            PANIC();
+        fpsimd_trap();
+    } break;
     case ESR_EC_IABORT_EL0:
+    case ESR_EC_DABORT_EL0: {
+        if (pgfault_handler(iss) != 0) {
+            printk("Page fault at %llx\n", arch_get_far());
+            thisproc()->killed = true;
+        }
+    } break;
     case ESR_EC_IABORT_EL1:
-    case ESR_EC_DABORT_EL0:
     case ESR_EC_DABORT_EL1: {
         printk("Page fault\n");
         PANIC();
@@ -42,7 +56,9 @@ void trap_global_handler(UserContext *context)
     }
     }
 
-    // TODO: stop killed process while returning to user space
+    // 被kill的进程在返回用户态之前退出（SPSR.M[3:0] == 0 表示来自EL0）
+    if (thisproc()->killed && (context->spsr & 0xf) == 0)
+        exit(-1);
 }
 
 NO_RETURN void trap_error_handler(u64 type)
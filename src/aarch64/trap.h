@@ -7,6 +7,7 @@
 #define ESR_IR_MASK (1 << 25)
 
 #define ESR_EC_UNKNOWN 0x00
+#define ESR_EC_FPSIMD 0x07
 #define ESR_EC_SVC64 0x15
 #define ESR_EC_IABORT_EL0 0x20
 #define ESR_EC_IABORT_EL1 0x21
@@ -50,13 +50,29 @@ int get_all_sem(Semaphore *sem)
     return ret;
 }
 
+// 一次唤醒的进程数上限（局部数组的大小）
+#define WAKE_BATCH 16
+
+// 唤醒所有等待者，返回唤醒的个数；val不小于0时保持不变
+// 等待者按批交给activate_procs，每批只获取一次调度队列的锁
 int post_all_sem(Semaphore *sem)
 {
-    int ret = -1;
+    Proc *procs[WAKE_BATCH];
+    int n = 0, ret = 0;
     _lock_sem(sem);
-    do
-        _post_sem(sem), ret++;
-    while (!_get_sem(sem));
+    while (sem->val < 0) {
+        sem->val++;
+        auto wait = container_of(sem->sleeplist.prev, WaitData, slnode);
+        wait->up = true;
+        _detach_from_list(&wait->slnode);
+        procs[n++] = wait->proc;
+        ret++;
+        if (n == WAKE_BATCH) {
+            activate_procs(procs, n);
+            n = 0;
+        }
+    }
+    activate_procs(procs, n);
     _unlock_sem(sem);
     return ret;
 }
@@ -67,22 +83,23 @@ bool _wait_sem(Semaphore *sem)
         release_spinlock(&sem->lock);
         return true;
     }
-    WaitData *wait = kalloc(sizeof(WaitData));
-    wait->proc = thisproc();
-    wait->up = false;
-    _insert_into_list(&sem->sleeplist, &wait->slnode);
+    // 等待记录放在自己的栈上：唤醒者只在持有sem->lock时访问它，
+    // 而我们要重新拿到sem->lock才会返回
+    WaitData wait;
+    wait.proc = thisproc();
+    wait.up = false;
+    _insert_into_list(&sem->sleeplist, &wait.slnode);
     acquire_sched_lock();
     release_spinlock(&sem->lock);
     sched(SLEEPING);
     acquire_spinlock(&sem->lock); // also the lock for waitdata
-    if (!wait->up) // wakeup by other sources
+    if (!wait.up) // wakeup by other sources
     {
         ASSERT(++sem->val <= 0);
-        _detach_from_list(&wait->slnode);
+        _detach_from_list(&wait.slnode);
     }
+    bool ret = wait.up;
     release_spinlock(&sem->lock);
-    bool ret = wait->up;
-    kfree(wait);
     return ret;
 }
 
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <common/spinlock.h>
+
+// 顺序锁：适合很小、读多写少的记录
+// 写者在修改前后各把序号加一（修改期间序号为奇数），
+// 读者不加锁地读出记录，序号在读前读后不变且为偶数才说明读到的是完整的一份，否则重读
+// 只有一个写者（如只由所属CPU更新的per-CPU数据）时直接用SeqCount，否则用带锁的SeqLock
+
+typedef struct {
+    u32 seq;
+} SeqCount;
+
+typedef struct {
+    SeqCount sc;
+    SpinLock lock; // 写者之间互斥
+} SeqLock;
+
+static INLINE void init_seqcount(SeqCount *s)
+{
+    s->seq = 0;
+}
+
+static INLINE void init_seqlock(SeqLock *s)
+{
+    init_seqcount(&s->sc);
+    init_spinlock(&s->lock);
+}
+
+static INLINE u32 read_seqbegin(SeqCount *s)
+{
+    u32 seq;
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+        arch_yield();
+    return seq;
+}
+
+// 读完记录后调用，返回true表示期间有写者，需要重读
+static INLINE bool read_seqretry(SeqCount *s, u32 start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != start;
+}
+
+static INLINE void write_seqcount_begin(SeqCount *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static INLINE void write_seqcount_end(SeqCount *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+static INLINE void write_seqlock(SeqLock *s)
+{
+    acquire_spinlock(&s->lock);
+    write_seqcount_begin(&s->sc);
+}
+
+static INLINE void write_sequnlock(SeqLock *s)
+{
+    write_seqcount_end(&s->sc);
+    release_spinlock(&s->lock);
+}
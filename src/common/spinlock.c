@@ -1,28 +1,200 @@
 #include <aarch64/intrinsic.h>
 #include <common/spinlock.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <common/string.h>
 
-void init_spinlock(SpinLock *lock)
+// 一个CPU同时持有或等待的锁不会超过MCS_NODES个
+#define MCS_NODES 32
+
+static struct mcs_node mcs_nodes[NCPU][MCS_NODES];
+// 置位表示节点正在使用：只有所属CPU会置位，释放锁的CPU清位
+static u32 mcs_used[NCPU];
+
+static struct mcs_node *alloc_node()
+{
+    usize cpu = cpuid();
+    u32 used = __atomic_load_n(&mcs_used[cpu], __ATOMIC_RELAXED);
+    if (used == ~0u)
+        PANIC();
+    int idx = __builtin_ctz(~used);
+    __atomic_fetch_or(&mcs_used[cpu], 1u << idx, __ATOMIC_RELAXED);
+
+    struct mcs_node *node = &mcs_nodes[cpu][idx];
+    node->cpu = (u8)cpu;
+    node->idx = (u8)idx;
+    node->next = NULL;
+    node->wait = true;
+    return node;
+}
+
+static void free_node(struct mcs_node *node)
+{
+    __atomic_fetch_and(&mcs_used[node->cpu], ~(1u << node->idx),
+                       __ATOMIC_RELEASE);
+}
+
+#ifdef LOCK_PROFILE
+
+#define LOCK_CLASSES 64
+#define LOCK_NAME_MAX 64
+
+// 0号类收纳未经init_spinlock初始化的锁，以及类表满了之后的新类
+static struct lock_class lock_classes[LOCK_CLASSES] = {
+    [0] = { .name = "(other)" },
+};
+static int nr_classes = 1;
+static bool class_lock; // 类表自己不能用SpinLock保护
+
+static struct lock_class *find_class(const char *name)
+{
+    while (__atomic_test_and_set(&class_lock, __ATOMIC_ACQUIRE))
+        arch_yield();
+
+    struct lock_class *cls = &lock_classes[0];
+    int i;
+    for (i = 1; i < nr_classes; i++) {
+        if (lock_classes[i].name == name ||
+            strncmp(lock_classes[i].name, name, LOCK_NAME_MAX) == 0) {
+            cls = &lock_classes[i];
+            break;
+        }
+    }
+    if (i == nr_classes && nr_classes < LOCK_CLASSES) {
+        cls = &lock_classes[nr_classes];
+        cls->name = name;
+        __atomic_store_n(&nr_classes, nr_classes + 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_clear(&class_lock, __ATOMIC_RELEASE);
+    return cls;
+}
+
+static void profile_acquired(SpinLock *lock, u64 site, bool contended,
+                             u64 spin)
+{
+    struct lock_class *cls = lock->cls ? lock->cls : &lock_classes[0];
+    __atomic_fetch_add(&cls->acquired, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_fetch_add(&cls->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cls->spin_ticks, spin, __ATOMIC_RELAXED);
+        __atomic_store_n(&cls->last_site, site, __ATOMIC_RELAXED);
+    }
+    lock->site = site;
+    lock->acquired_at = get_timestamp();
+}
+
+static void profile_released(SpinLock *lock)
+{
+    struct lock_class *cls = lock->cls ? lock->cls : &lock_classes[0];
+    u64 hold = get_timestamp() - lock->acquired_at;
+    u64 max = __atomic_load_n(&cls->max_hold, __ATOMIC_RELAXED);
+    while (hold > max) {
+        if (__atomic_compare_exchange_n(&cls->max_hold, &max, hold, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            // 与max_hold不是原子地一起更新，并发时可能对不上，仅供参考
+            __atomic_store_n(&cls->max_site, lock->site, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+}
+
+#define lock_clock() get_timestamp()
+
+// 按排队等待的总计数从多到少打印前top个类
+void lock_profile_dump(int top)
+{
+    bool shown[LOCK_CLASSES] = { 0 };
+    int n = __atomic_load_n(&nr_classes, __ATOMIC_ACQUIRE);
+
+    printk("lock profile (ticks, top %d by waiting):\n", top);
+    for (int k = 0; k < top; k++) {
+        int best = -1;
+        for (int i = 0; i < n; i++) {
+            if (!shown[i] && lock_classes[i].acquired != 0 &&
+                (best < 0 ||
+                 lock_classes[i].spin_ticks > lock_classes[best].spin_ticks))
+                best = i;
+        }
+        if (best < 0)
+            break;
+        shown[best] = true;
+
+        struct lock_class *c = &lock_classes[best];
+        printk("  %s: %llu acquired, %llu contended, %llu waiting, "
+               "max hold %llu at 0x%llx, last contended at 0x%llx\n",
+               c->name, c->acquired, c->contended, c->spin_ticks, c->max_hold,
+               c->max_site, c->last_site);
+    }
+}
+
+#else
+
+#define profile_acquired(lock, site, contended, spin) ((void)(spin))
+#define profile_released(lock)
+#define lock_clock() 0
+
+#endif
+
+void _init_spinlock(SpinLock *lock, const char *name)
 {
-    lock->locked = 0;
+    lock->tail = NULL;
+    lock->holder = NULL;
+#ifdef LOCK_PROFILE
+    lock->cls = find_class(name);
+#else
+    (void)name;
+#endif
 }
 
 bool try_acquire_spinlock(SpinLock *lock)
 {
-    if (!lock->locked &&
-        !__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
-        return true;
-    } else {
+    if (__atomic_load_n(&lock->tail, __ATOMIC_RELAXED) != NULL)
         return false;
+
+    struct mcs_node *node = alloc_node(), *expected = NULL;
+    if (__atomic_compare_exchange_n(&lock->tail, &expected, node, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        lock->holder = node;
+        profile_acquired(lock, (u64)__builtin_return_address(0), false, 0);
+        return true;
     }
+    free_node(node);
+    return false;
 }
 
 void acquire_spinlock(SpinLock *lock)
 {
-    while (!try_acquire_spinlock(lock))
-        arch_yield();
+    struct mcs_node *node = alloc_node();
+    struct mcs_node *prev =
+            __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    u64 spin = 0;
+    if (prev != NULL) {
+        u64 start = lock_clock();
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        // 释放者先清wait再sev，即使sev发生在wfe之前，事件也已记下，wfe不会睡过头
+        while (__atomic_load_n(&node->wait, __ATOMIC_ACQUIRE))
+            arch_wfe();
+        spin = lock_clock() - start;
+    }
+    lock->holder = node;
+    profile_acquired(lock, (u64)__builtin_return_address(0), prev != NULL,
+                     spin);
 }
 
 void release_spinlock(SpinLock *lock)
 {
-    __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+    profile_released(lock);
+    struct mcs_node *node = lock->holder, *expected = node;
+    if (!__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // 有后继：它可能还没来得及挂到node->next上
+        struct mcs_node *next;
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+            arch_yield();
+        __atomic_store_n(&next->wait, false, __ATOMIC_RELEASE);
+        arch_dsb_ishst();
+        arch_sev();
+    }
+    free_node(node);
 }
@@ -3,11 +3,52 @@
 #include <common/defines.h>
 #include <aarch64/intrinsic.h>
 
+// MCS队列锁：等待者按到达顺序排队，各自在自己的节点上等待（wfe），
+// 前一个持有者释放时只写后继的节点并sev，不会所有等待者争抢同一个缓存行
+// 节点取自当前CPU的节点池，由持有者记在锁里，释放时（可以在任一CPU上）归还
+struct mcs_node {
+    struct mcs_node *next; // 排在后面的等待者
+    bool wait;             // 前一个持有者释放时清零
+    u8 cpu, idx;           // 所属的节点池及其中的下标
+} __attribute__((aligned(64)));
+
+#ifdef LOCK_PROFILE
+// 锁竞争统计（构建时打开LOCK_PROFILE）：按锁的名字（init_spinlock的参数文本）归类，
+// 同一处初始化的锁（如所有进程的p->lock）共用一个类
+struct lock_class {
+    const char *name;
+    u64 acquired;    // 获取次数
+    u64 contended;   // 需要排队的获取次数
+    u64 spin_ticks;  // 排队等待的总计数
+    u64 max_hold;    // 最长的一次持有
+    u64 max_site;    // 最长的那次持有是在哪里获取的
+    u64 last_site;   // 最近一次需要排队的获取发生在哪里
+};
+#endif
+
 typedef struct {
-    volatile bool locked;
+    struct mcs_node *tail;   // 队尾，NULL表示未上锁
+    struct mcs_node *holder; // 持有者的节点，只由持有者读写
+#ifdef LOCK_PROFILE
+    struct lock_class *cls;  // NULL表示未经init_spinlock初始化（静态的零值锁）
+    u64 acquired_at;         // 以下由持有者读写
+    u64 site;
+#endif
 } SpinLock;
 
-void init_spinlock(SpinLock *);
+// 锁的名字就是参数的文本，如init_spinlock(&kmem.lock)的类名为"&kmem.lock"
+#define init_spinlock(lock) _init_spinlock(lock, #lock)
+
+void _init_spinlock(SpinLock *, const char *name);
 bool try_acquire_spinlock(SpinLock *);
 void acquire_spinlock(SpinLock *);
 void release_spinlock(SpinLock *);
+
+#ifdef LOCK_PROFILE
+void lock_profile_dump(int top);
+#else
+static INLINE void lock_profile_dump(int top)
+{
+    (void)top;
+}
+#endif
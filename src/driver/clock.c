@@ -14,6 +14,8 @@ void init_clock()
 {
     // reserve one second for the first time.
     enable_timer();
+    // user code reads the virtual counter directly, see kernel/vdso.h
+    arch_enable_el0_vct();
     reset_clock(1000);
 }
 
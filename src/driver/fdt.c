@@ -0,0 +1,103 @@
+#include <driver/fdt.h>
+#include <driver/memlayout.h>
+#include <common/string.h>
+
+/**
+ * A minimal reader for the flattened device tree, just enough to find
+ * the size of RAM. See the Devicetree Specification, chapter 5.
+ */
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE 0x2
+#define FDT_PROP 0x3
+#define FDT_NOP 0x4
+#define FDT_END 0x9
+
+struct fdt_header {
+    u32 magic;
+    u32 totalsize;
+    u32 off_dt_struct;
+    u32 off_dt_strings;
+    u32 off_mem_rsvmap;
+    u32 version;
+    u32 last_comp_version;
+    u32 boot_cpuid_phys;
+    u32 size_dt_strings;
+    u32 size_dt_struct;
+};
+
+static u32 be32(const void *p)
+{
+    return __builtin_bswap32(*(const u32 *)p);
+}
+
+static u64 read_cells(const u32 *p, u32 cells)
+{
+    u64 v = 0;
+    for (u32 i = 0; i < cells; i++)
+        v = (v << 32) | be32(&p[i]);
+    return v;
+}
+
+/**
+ * Return the end of the highest RAM bank described by the device tree at
+ * physical address `fdt`, or 0 if there is no valid tree there.
+ * Only the first GiB of RAM is mapped at boot, so the tree must lie in it.
+ */
+u64 fdt_memory_end(u64 fdt)
+{
+    if (fdt < EXTMEM || fdt >= PHYSTOP || fdt % 8)
+        return 0;
+
+    const struct fdt_header *hdr = (const struct fdt_header *)P2K_WO(fdt);
+    if (be32(&hdr->magic) != FDT_MAGIC || fdt + be32(&hdr->totalsize) > PHYSTOP)
+        return 0;
+
+    const char *strings = (const char *)hdr + be32(&hdr->off_dt_strings);
+    const u32 *p = (const u32 *)((const char *)hdr + be32(&hdr->off_dt_struct));
+    u32 addr_cells = 2, size_cells = 1;
+    int depth = 0;
+    bool in_memory = false;
+    u64 top = 0;
+
+    for (;;) {
+        u32 token = be32(p++);
+        if (token == FDT_BEGIN_NODE) {
+            const char *name = (const char *)p;
+            depth++;
+            // /memory or /memory@<addr>, directly under the root
+            in_memory = depth == 2 && strncmp(name, "memory", 6) == 0 &&
+                        (name[6] == '\0' || name[6] == '@');
+            p += (strlen(name) + 4) / 4;
+        } else if (token == FDT_END_NODE) {
+            depth--;
+            in_memory = false;
+        } else if (token == FDT_PROP) {
+            u32 len = be32(p++);
+            const char *pname = strings + be32(p++);
+            const u32 *val = p;
+            p += (len + 3) / 4;
+
+            if (depth == 1 && strncmp(pname, "#address-cells", 15) == 0)
+                addr_cells = be32(val);
+            else if (depth == 1 && strncmp(pname, "#size-cells", 12) == 0)
+                size_cells = be32(val);
+            else if (in_memory && strncmp(pname, "reg", 4) == 0) {
+                u32 entry = addr_cells + size_cells;
+                for (u32 i = 0; entry && (i + entry) * 4 <= len; i += entry) {
+                    u64 base = read_cells(val + i, addr_cells);
+                    u64 size = read_cells(val + i + addr_cells, size_cells);
+                    if (base + size > top)
+                        top = base + size;
+                }
+            }
+        } else if (token == FDT_NOP) {
+            continue;
+        } else {
+            break; // FDT_END or garbage
+        }
+    }
+
+    return top;
+}
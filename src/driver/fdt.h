@@ -0,0 +1,5 @@
+#pragma once
+
+#include <common/defines.h>
+
+u64 fdt_memory_end(u64 fdt);
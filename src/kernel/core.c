@@ -1,7 +1,9 @@
 #include <aarch64/intrinsic.h>
 #include <kernel/cpu.h>
 #include <kernel/printk.h>
+#include <kernel/pt.h>
 #include <kernel/sched.h>
+#include <kernel/rcu.h>
 #include <test/test.h>
 
 volatile bool panic_flag;
@@ -17,10 +19,17 @@ NO_RETURN void idle_entry()
 
         if (panic_flag)
             break;
+
+        // 没有可运行的进程时执行RCU回调、回收已销毁的地址空间，有活可干就先不睡眠
+        bool busy = rcu_process();
+        busy |= reclaim_pgdir();
+        if (busy || !rcu_idle_enter())
+            continue;
         arch_with_trap
         {
             arch_wfi();
         }
+        rcu_idle_exit();
     }
     set_cpu_off();
     arch_stop_cpu();
@@ -30,8 +39,14 @@ NO_RETURN void kernel_entry()
 {
     printk("Hello world! (Core %lld)\n", cpuid());
     // proc_test();
+#ifdef KERNEL_BENCH
+    sched_bench();
+    spinlock_bench();
+#endif
     vm_test();
+    vm_range_test();
     user_proc_test();
+    lock_profile_dump(10);
 
     while (1)
         yield();
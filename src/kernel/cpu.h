@@ -9,6 +9,7 @@
 struct sched {
     Proc *current;  // 当前正在运行的进程，或着为空
     Proc *idle;     // 当前CPU的专属idle进程
+    Proc *prev;     // 刚被换出的进程（它的锁由换入的进程释放）
 };
 
 struct cpu {
@@ -0,0 +1,88 @@
+#include <kernel/fpsimd.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <kernel/mem.h>
+#include <kernel/cpu.h>
+#include <common/string.h>
+#include <aarch64/intrinsic.h>
+
+// 惰性保存/恢复用户进程的FP/SIMD寄存器：
+// 进程默认不能使用FP/SIMD（CPACR陷入EL0的访问），第一次使用时陷入fpsimd_trap，
+// 此时才为其分配保存区并把它的状态装入寄存器，该CPU的寄存器从此归它所有（fp_owner）
+// 换出时只有本时间片用过FP/SIMD的进程才需要保存；再换回同一CPU时，
+// 若寄存器仍是它的状态（期间没有别的进程装入），直接放开访问，不必恢复
+// 内核以-mgeneral-regs-only编译，从不使用这些寄存器
+
+static struct {
+    struct Proc *owner; // 寄存器中装着谁的状态
+    bool enabled;       // 当前进程是否可以直接访问（本时间片用过）
+} fp_cpu[NCPU];
+
+void init_fpsimd_percpu()
+{
+    fp_cpu[cpuid()].owner = NULL;
+    fp_cpu[cpuid()].enabled = false;
+    arch_set_fpen(CPACR_FPEN_TRAP_EL0);
+}
+
+// 用户进程第一次在本时间片中使用FP/SIMD
+void fpsimd_trap()
+{
+    auto fp = &fp_cpu[cpuid()];
+    Proc *p = thisproc();
+
+    if (p->fpsimd == NULL) {
+        p->fpsimd = kalloc(sizeof(FpsimdState));
+        memset(p->fpsimd, 0, sizeof(FpsimdState));
+    }
+    // 上一个所有者换出时已经保存过，直接覆盖
+    if (fp->owner != p || p->fpsimd_cpu != (int)cpuid())
+        fpsimd_load(p->fpsimd);
+
+    fp->owner = p;
+    fp->enabled = true;
+    p->fpsimd_cpu = cpuid();
+    arch_set_fpen(CPACR_FPEN_NO_TRAP);
+}
+
+// 进程切换时调用（持有调度锁）
+void fpsimd_switch(struct Proc *prev, struct Proc *next)
+{
+    auto fp = &fp_cpu[cpuid()];
+
+    // prev在本时间片中可能改过寄存器，保存下来；寄存器仍然归它所有
+    if (fp->enabled) {
+        fpsimd_save(prev->fpsimd);
+        fp->enabled = false;
+    }
+
+    // 寄存器中恰好是next的状态时不必再陷入
+    if (fp->owner == next && next->fpsimd_cpu == (int)cpuid()) {
+        fp->enabled = true;
+        arch_set_fpen(CPACR_FPEN_NO_TRAP);
+    } else {
+        arch_set_fpen(CPACR_FPEN_TRAP_EL0);
+    }
+}
+
+// 子进程继承父进程的FP/SIMD状态（由父进程调用）
+void fpsimd_fork(struct Proc *child, struct Proc *parent)
+{
+    if (parent->fpsimd == NULL)
+        return;
+    if (fp_cpu[cpuid()].enabled)
+        fpsimd_save(parent->fpsimd);
+    child->fpsimd = kalloc(sizeof(FpsimdState));
+    memcpy(child->fpsimd, parent->fpsimd, sizeof(FpsimdState));
+}
+
+// 释放进程的FP/SIMD保存区（进程已完全换出）
+// 某个CPU的owner可能仍指向p，但fpsimd_cpu被清除，p被复用后不会误认寄存器中的旧状态
+void fpsimd_free(struct Proc *p)
+{
+    if (p->fpsimd != NULL) {
+        kfree(p->fpsimd);
+        p->fpsimd = NULL;
+    }
+    p->fpsimd_cpu = -1;
+}
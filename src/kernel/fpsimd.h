@@ -0,0 +1,11 @@
+#pragma once
+
+#include <aarch64/fpsimd.h>
+
+struct Proc;
+
+void init_fpsimd_percpu();
+void fpsimd_trap();
+void fpsimd_switch(struct Proc *prev, struct Proc *next);
+void fpsimd_fork(struct Proc *child, struct Proc *parent);
+void fpsimd_free(struct Proc *p);
@@ -1,9 +1,10 @@
 #include <aarch64/mmu.h>
 #include <common/rc.h>
 #include <common/spinlock.h>
+#include <common/string.h>
 #include <driver/memlayout.h>
 #include <kernel/mem.h>
- #include <kernel/printk.h>
+#include <kernel/printk.h>
 #define PGROUNDUP(sz)  (((sz)+PAGE_SIZE-1) & ~(PAGE_SIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PAGE_SIZE-1))
 #define NUM_CACHE 10    // 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096(可能4088)
@@ -14,6 +15,22 @@ void freerange(void* pa_start, void* pa_end);
 
 extern char end[];  // first address after kernel.(but it is a virtual address)
 
+// 物理内存的上界，由kinit根据启动时探测到的内存大小设置
+static u64 phystop;
+
+// 物理页的引用计数（只统计kalloc_page分配出去的页，下标为物理页号）
+// 一个页可以被多个页表共享（如fork后的写时复制），引用归零时才真正释放
+// 数组大小取决于内存大小，kinit时紧接着内核镜像分配
+static u32* page_ref;
+static char* kmem_start; // 第一个归分配器管理的页
+
+// 返回页p的引用计数的位置，不归分配器管理的页返回NULL
+static u32* page_ref_of(void* p) {
+    if ((usize)p % PAGE_SIZE || (char*)p < kmem_start || (usize)p >= P2K(phystop))
+        return NULL;
+    return &page_ref[(K2P(p) - EXTMEM) / PAGE_SIZE];
+}
+
 // 空闲物理页节点
 struct run {
     struct run* next;
@@ -154,16 +171,26 @@ void slab_free(struct Cache* cache, void* obj) {
 void freerange(void* pa_start, void* pa_end) {
     char *p;
     for(p = (char*)PGROUNDUP((usize)pa_start); p + PAGE_SIZE <= (char*)pa_end; p += PAGE_SIZE) {
+        *page_ref_of(p) = 1;
         kfree_page(p);
     }
 }
 
 
 
-void kinit() {
+// 初始化分配器，memtop为物理内存的上界
+// 启动时只映射了PHYSTOP以下的内存，更高的部分等内核页表建好后由kinit_highmem加入
+void kinit(u64 memtop) {
     init_rc(&kalloc_page_cnt);
     init_spinlock(&kmem.lock);
-    freerange((void*)end, (void*)P2K(PHYSTOP));
+
+    phystop = memtop;
+    usize npages = (phystop - EXTMEM) / PAGE_SIZE;
+    page_ref = (u32*)PGROUNDUP((usize)end);
+    memset(page_ref, 0, npages * sizeof(u32));
+    kmem_start = (char*)PGROUNDUP((usize)(page_ref + npages));
+
+    freerange(kmem_start, (void*)P2K(MIN(phystop, (u64)PHYSTOP)));
     init_caches();
 
 
@@ -180,6 +207,12 @@ void kinit() {
     */
 }
 
+// 将PHYSTOP以上的内存加入分配器（需在init_kernel_pt之后调用）
+void kinit_highmem() {
+    if (phystop > PHYSTOP)
+        freerange((void*)P2K(PHYSTOP), (void*)P2K(phystop));
+}
+
 void* kalloc_page() {
     increment_rc(&kalloc_page_cnt);
     struct run *r;
@@ -193,21 +226,44 @@ void* kalloc_page() {
 
     if(r){
         //memset((char*)r, 5, PAGE_SIZE);  // 填充垃圾数据
+        __atomic_store_n(page_ref_of(r), 1, __ATOMIC_RELAXED);
         return (void*)r;
     } else {
         return NULL;    // 没有空闲物理页
     }
 }
 
+// 一次加锁从空闲链表中取出至多n页放入pages，返回实际取到的页数
+usize kalloc_pages(void** pages, usize n) {
+    usize got = 0;
+
+    acquire_spinlock(&kmem.lock);   // 加锁
+    while(got < n && kmem.freelist) {
+        pages[got++] = kmem.freelist;
+        kmem.freelist = kmem.freelist->next;
+    }
+    release_spinlock(&kmem.lock);   // 解锁
+
+    for(usize i = 0; i < got; i++) {
+        increment_rc(&kalloc_page_cnt);
+        __atomic_store_n(page_ref_of(pages[i]), 1, __ATOMIC_RELAXED);
+    }
+    return got;
+}
+
+// 放弃对页p的一次引用，最后一个引用被放弃时才将其放回空闲链表
 void kfree_page(void* p) {
-    decrement_rc(&kalloc_page_cnt);
     struct run *r;
+    u32 *ref = page_ref_of(p);
 
-    if((usize)p % PAGE_SIZE || (usize)p < (usize)end || (usize)p >= P2K(PHYSTOP)) {
+    if(ref == NULL || *ref == 0) {
         printk("kfree_page fail: p = %p\n", p);   
         return;
     }
+    if(__atomic_sub_fetch(ref, 1, __ATOMIC_ACQ_REL) > 0)
+        return;     // 仍被其他页表共享
 
+    decrement_rc(&kalloc_page_cnt);
     //memset(p, 1, PAGE_SIZE);        // 填充垃圾数据
     r = (struct run*)p;
     acquire_spinlock(&kmem.lock);   // 加锁
@@ -217,6 +273,50 @@ void kfree_page(void* p) {
     return;
 }
 
+// 批量放弃对n个页的引用，引用归零的页串成链表后一次加锁放回空闲链表
+void kfree_pages(void** pages, usize n) {
+    struct run *head = NULL, *tail = NULL;
+
+    for(usize i = 0; i < n; i++) {
+        u32 *ref = page_ref_of(pages[i]);
+        if(ref == NULL || *ref == 0) {
+            printk("kfree_pages fail: p = %p\n", pages[i]);
+            continue;
+        }
+        if(__atomic_sub_fetch(ref, 1, __ATOMIC_ACQ_REL) > 0)
+            continue;   // 仍被其他页表共享
+
+        decrement_rc(&kalloc_page_cnt);
+        struct run *r = (struct run*)pages[i];
+        r->next = head;
+        head = r;
+        if(tail == NULL)
+            tail = r;
+    }
+
+    if(head == NULL)
+        return;
+    acquire_spinlock(&kmem.lock);   // 加锁
+    tail->next = kmem.freelist;
+    kmem.freelist = head;
+    release_spinlock(&kmem.lock);   // 解锁
+}
+
+
+
+// 为页p增加一次引用（用于多个页表共享同一物理页），不归分配器管理的页忽略
+void kshare_page(void* p) {
+    u32 *ref = page_ref_of(p);
+    if(ref)
+        __atomic_fetch_add(ref, 1, __ATOMIC_ACQ_REL);
+}
+
+// 返回页p当前的引用计数，不归分配器管理的页返回0
+u32 kpage_ref(void* p) {
+    u32 *ref = page_ref_of(p);
+    return ref ? __atomic_load_n(ref, __ATOMIC_ACQUIRE) : 0;
+}
+
 
 
 void* kalloc(unsigned long long size) {
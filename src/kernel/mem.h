@@ -1,9 +1,16 @@
 #pragma once
 
-void kinit();
+#include <common/defines.h>
+
+void kinit(u64 memtop);
+void kinit_highmem();
 
 void* kalloc_page();
 void kfree_page(void*);
+usize kalloc_pages(void**, usize);
+void kfree_pages(void**, usize);
+void kshare_page(void*);
+unsigned int kpage_ref(void*);
 
 void* kalloc(unsigned long long);
 void kfree(void*);
@@ -0,0 +1,331 @@
+#include <kernel/paging.h>
+#include <kernel/pt.h>
+#include <kernel/mem.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <kernel/vdso.h>
+#include <common/string.h>
+#include <aarch64/intrinsic.h>
+
+#define st_of(node) container_of(node, struct section, stnode)
+
+// 区域按地址排序且互不重叠：l完全位于r之前时l < r，重叠的两个区域视为相等
+static bool section_cmp(rb_node lnode, rb_node rnode)
+{
+    return st_of(lnode)->end <= st_of(rnode)->begin;
+}
+
+void init_sections(struct pgdir *pd)
+{
+    pd->section_root.rb_node = NULL;
+    pd->heap_begin = pd->brk = USER_HEAP_BASE;
+}
+
+// 查找与[begin, end)重叠的任一区域，没有则返回NULL（需持有pd->lock）
+static struct section *lookup_section(struct pgdir *pd, u64 begin, u64 end)
+{
+    struct section key = { .begin = begin, .end = end };
+    rb_node node = _rb_lookup(&key.stnode, &pd->section_root, section_cmp);
+    return node ? st_of(node) : NULL;
+}
+
+// 查找包含addr的区域，没有则返回NULL（需持有pd->lock）
+static struct section *find_section(struct pgdir *pd, u64 addr)
+{
+    return lookup_section(pd, addr, addr + 1);
+}
+
+// 插入区域[begin, end)，与已有区域重叠时返回NULL（需持有pd->lock）
+static struct section *insert_section(struct pgdir *pd, u64 begin, u64 end,
+                                      u64 flags)
+{
+    struct section *st = kalloc(sizeof(struct section));
+    st->flags = flags;
+    st->begin = begin;
+    st->end = end;
+    if (_rb_insert(&st->stnode, &pd->section_root, section_cmp) != 0) {
+        kfree(st);
+        return NULL;
+    }
+    return st;
+}
+
+static void erase_section(struct pgdir *pd, struct section *st)
+{
+    _rb_erase(&st->stnode, &pd->section_root);
+    kfree(st);
+}
+
+// 在地址空间中登记区域[begin, end)，不立即分配物理页，由缺页处理按需分配
+// begin、end需按页对齐；与已有区域重叠时返回-1
+int add_section(struct pgdir *pd, u64 begin, u64 end, u64 flags)
+{
+    if (begin >= end || begin % PAGE_SIZE || end % PAGE_SIZE)
+        return -1;
+
+    acquire_spinlock(&pd->lock);
+    struct section *st = insert_section(pd, begin, end, flags);
+    release_spinlock(&pd->lock);
+    return st ? 0 : -1;
+}
+
+// fork时复制区域描述，页本身由copy_pgdir写时复制地共享
+int copy_sections(struct pgdir *dst, struct pgdir *src)
+{
+    acquire_spinlock(&src->lock);
+    for (rb_node p = _rb_first(&src->section_root); p; p = _rb_next(p)) {
+        struct section *s = st_of(p);
+        insert_section(dst, s->begin, s->end, s->flags);
+    }
+    dst->heap_begin = src->heap_begin;
+    dst->brk = src->brk;
+    release_spinlock(&src->lock);
+    return 0;
+}
+
+// 释放所有区域描述（页由destroy_pgdir释放）
+void free_sections(struct pgdir *pd)
+{
+    acquire_spinlock(&pd->lock);
+    rb_node p;
+    while ((p = _rb_first(&pd->section_root)) != NULL)
+        erase_section(pd, st_of(p));
+    release_spinlock(&pd->lock);
+}
+
+// 从地址空间中去掉[begin, end)：裁剪或拆分与之重叠的区域，并解除其中的映射（需持有pd->lock）
+static void remove_range(struct pgdir *pd, u64 begin, u64 end)
+{
+    struct section *st;
+
+    while ((st = lookup_section(pd, begin, end)) != NULL) {
+        if (st->begin < begin && end < st->end) {
+            // 区域被挖去中间一段，拆成两个
+            u64 tail = st->end;
+            st->end = begin;
+            insert_section(pd, end, tail, st->flags);
+        } else if (st->begin < begin) {
+            st->end = begin;
+        } else if (end < st->end) {
+            st->begin = end;
+        } else {
+            erase_section(pd, st);
+        }
+    }
+    unmap_range(pd, begin, end - begin);
+}
+
+// 从hint开始寻找第一段长为len的空闲地址（需持有pd->lock），找不到返回0
+static u64 find_free_range(struct pgdir *pd, u64 hint, u64 len)
+{
+    u64 addr = hint;
+
+    for (rb_node p = _rb_first(&pd->section_root); p; p = _rb_next(p)) {
+        struct section *st = st_of(p);
+        if (st->end <= addr)
+            continue;
+        if (addr + len <= st->begin)
+            break;
+        addr = st->end;
+    }
+    return addr + len <= USER_VDSO_BASE ? addr : 0;
+}
+
+// 将内核分配的n个物理页映射到当前进程一段空闲的地址上（用于与内核共享的页），
+// 映射持有每页一次引用，随地址空间一起释放；成功返回起始地址，失败返回MAP_FAILED
+u64 map_kernel_pages(void **pages, usize n)
+{
+    struct pgdir *pd = &thisproc()->pgdir;
+    u64 len = n * PAGE_SIZE;
+
+    acquire_spinlock(&pd->lock);
+    u64 addr = find_free_range(pd, USER_MMAP_BASE, len);
+    if (addr == 0 ||
+        insert_section(pd, addr, addr + len, ST_SHARED) == NULL) {
+        release_spinlock(&pd->lock);
+        return MAP_FAILED;
+    }
+    for (usize i = 0; i < n; i++) {
+        kshare_page(pages[i]);
+        map_range(pd, addr + i * PAGE_SIZE, K2P(pages[i]), PAGE_SIZE,
+                  PTE_USER_DATA | PTE_SHARED);
+    }
+    release_spinlock(&pd->lock);
+    return addr;
+}
+
+// 匿名映射：登记一段区域，页在第一次访问时才分配
+// 不支持文件映射；成功返回映射的起始地址，失败返回MAP_FAILED
+u64 mmap(u64 addr, u64 len, int prot, int flags, int fd, u64 offset)
+{
+    struct pgdir *pd = &thisproc()->pgdir;
+    u64 stflags = (prot & PROT_WRITE) ? 0 : ST_RO;
+
+    if (!(flags & MAP_ANONYMOUS) || len == 0 || addr % PAGE_SIZE)
+        return MAP_FAILED;
+    len = round_up(len, PAGE_SIZE);
+    if (addr + len > USER_TOP || addr + len < addr)
+        return MAP_FAILED;
+
+    acquire_spinlock(&pd->lock);
+    if (flags & MAP_FIXED) {
+        if (addr == 0)
+            goto fail;
+        remove_range(pd, addr, addr + len);
+    } else if (addr == 0 || lookup_section(pd, addr, addr + len)) {
+        // 提示地址不可用时另找一段
+        addr = find_free_range(pd, USER_MMAP_BASE, len);
+        if (addr == 0)
+            goto fail;
+    }
+    if (insert_section(pd, addr, addr + len, stflags) == NULL)
+        goto fail;
+    release_spinlock(&pd->lock);
+    return addr;
+
+fail:
+    release_spinlock(&pd->lock);
+    return MAP_FAILED;
+}
+
+// 解除[addr, addr + len)的映射，区间内没有映射也不算错误
+int munmap(u64 addr, u64 len)
+{
+    struct pgdir *pd = &thisproc()->pgdir;
+
+    if (addr % PAGE_SIZE || len == 0)
+        return -1;
+    len = round_up(len, PAGE_SIZE);
+    if (addr + len > USER_TOP || addr + len < addr)
+        return -1;
+
+    acquire_spinlock(&pd->lock);
+    remove_range(pd, addr, addr + len);
+    release_spinlock(&pd->lock);
+    return 0;
+}
+
+// 将堆顶（program break）设为addr，堆区域[heap_begin, brk)随之伸缩
+// 与Linux一致，返回新的堆顶；addr非法或空间不足时返回原来的堆顶
+u64 brk(u64 addr)
+{
+    struct pgdir *pd = &thisproc()->pgdir;
+
+    acquire_spinlock(&pd->lock);
+    u64 begin = pd->heap_begin;
+    u64 old_end = round_up(pd->brk, PAGE_SIZE);
+    u64 new_end = round_up(addr, PAGE_SIZE);
+
+    if (addr < begin || new_end > USER_TOP)
+        goto out;
+
+    if (new_end > old_end) {
+        if (lookup_section(pd, old_end, new_end))
+            goto out; // 与其他区域冲突
+        // munmap可能在堆中挖了洞，只延伸紧挨着原堆顶的那一段；
+        // 原堆顶处没有堆区域（堆为空或最后一页已被解除映射）时插入新的一段
+        struct section *heap =
+                old_end > begin ? find_section(pd, old_end - 1) : NULL;
+        if (heap && (heap->flags & ST_HEAP))
+            heap->end = new_end; // [old_end, new_end)中没有其他区域，顺序不变
+        else if (insert_section(pd, old_end, new_end, ST_HEAP) == NULL)
+            goto out;
+    } else if (new_end < old_end) {
+        remove_range(pd, new_end, old_end);
+    }
+    pd->brk = addr;
+
+out:
+    addr = pd->brk;
+    release_spinlock(&pd->lock);
+    return addr;
+}
+
+// 全局共享的零页：位于内核镜像中，不归分配器管理（kpage_ref为0），因此永远不会被释放
+static u8 zero_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+// 第一次访问区域中的页（原表项无效，TLB中不会有它的缓存，不需要刷新）
+// 读：只读地映射零页，可写区域同时标记为写时复制，第一次写时再分配私有页
+// 写：直接分配一页清零的私有页
+static void map_fresh_page(struct pgdir *pd, struct section *st, u64 addr,
+                           bool write)
+{
+    u64 va = round_down(addr, PAGE_SIZE);
+
+    if (!write) {
+        map_range(pd, va, K2P(zero_page), PAGE_SIZE,
+                  PTE_USER_DATA | PTE_RO | ((st->flags & ST_RO) ? 0 : PTE_COW));
+        return;
+    }
+
+    void *page = kalloc_page();
+    memset(page, 0, PAGE_SIZE);
+    map_range(pd, va, K2P(page), PAGE_SIZE, PTE_USER_DATA);
+}
+
+// 处理写时复制页上的写操作：页只剩一个引用时直接恢复可写，否则复制一份
+static void copy_on_write(PTEntry *pte)
+{
+    void *old = (void *)P2K(PTE_ADDRESS(*pte));
+    u64 flags = PTE_FLAGS(*pte) & ~(PTE_RO | PTE_COW);
+
+    if (kpage_ref(old) == 1) {
+        *pte = K2P(old) | flags;
+    } else {
+        void *page = kalloc_page();
+        if (old == zero_page)
+            memset(page, 0, PAGE_SIZE);
+        else
+            memcpy(page, old, PAGE_SIZE);
+        *pte = K2P(page) | flags;
+        if (kpage_ref(old))
+            kfree_page(old);
+    }
+}
+
+// 用户态缺页处理，成功返回0，非法访问返回-1
+// 地址转换故障：若地址属于某个区域，则按需映射零页或分配一页；权限故障：处理写时复制
+// 读写由ISS.WnR区分，指令异常的WnR为0，按读处理
+int pgfault_handler(u64 iss)
+{
+    struct pgdir *pd = &thisproc()->pgdir;
+    u64 addr = arch_get_far();
+    u64 fsc = iss & ISS_FSC_MASK;
+    int ret = -1;
+
+    acquire_spinlock(&pd->lock);
+    struct section *st = find_section(pd, addr);
+    if (st == NULL) {
+        // 每个地址空间的最高一页都是共享的时间数据页，第一次读时映射（除非被mmap覆盖）
+        if (fsc == ISS_FSC_TRANSLATION && !(iss & ISS_WNR) &&
+            round_down(addr, PAGE_SIZE) == USER_VDSO_BASE) {
+            map_range(pd, USER_VDSO_BASE, K2P(vdso_page()), PAGE_SIZE,
+                      PTE_USER_DATA | PTE_RO);
+            ret = 0;
+        }
+        goto out;
+    }
+
+    if (fsc == ISS_FSC_TRANSLATION) {
+        if ((st->flags & ST_RO) && (iss & ISS_WNR))
+            goto out;
+        map_fresh_page(pd, st, addr, iss & ISS_WNR);
+        ret = 0;
+    } else if (fsc == ISS_FSC_PERMISSION && (iss & ISS_WNR)) {
+        // alloc=true会先拆分被共享的最后一级页表
+        PTEntriesPtr pte = get_pte(pd, addr, true);
+        if (!(*pte & PTE_VALID))
+            goto out;
+        if (*pte & PTE_COW)
+            copy_on_write(pte);
+        else if (*pte & PTE_RO)
+            goto out; // 真正的只读页
+        // 否则只是最后一级页表被共享（如fork后的PTE_SHARED页），拆分后已可写
+        flush_pgdir_va(pd, addr);
+        ret = 0;
+    }
+
+out:
+    release_spinlock(&pd->lock);
+    return ret;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/rbtree.h>
+
+// ESR中数据/指令异常的ISS字段
+#define ISS_WNR (1 << 6)            // 写操作引起的异常
+#define ISS_FSC_MASK 0x3c           // 故障状态码（忽略表示级别的低两位）
+#define ISS_FSC_TRANSLATION 0x04    // 地址转换故障
+#define ISS_FSC_PERMISSION 0x0c     // 权限故障
+
+// 区域属性
+#define ST_RO (1 << 0)    // 只读
+#define ST_HEAP (1 << 1)  // 堆
+#define ST_STACK (1 << 2) // 栈
+#define ST_SHARED (1 << 3) // 与内核共享（map_kernel_pages），fork后共享而不写时复制
+
+// 用户地址空间布局
+#define USER_HEAP_BASE 0x10000000ULL   // 堆的起始地址
+#define USER_MMAP_BASE 0x1000000000ULL // 未指定地址的mmap从这里开始寻找空闲区间
+#define USER_TOP 0x1000000000000ULL    // 用户地址空间上界（TTBR0，48位）
+#define USER_VDSO_BASE (USER_TOP - PAGE_SIZE) // 只读的时间数据页（struct vdso_data）
+
+// mmap参数，与Linux一致
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED ((u64)-1)
+
+struct pgdir;
+
+// 地址空间中的一段区域[begin, end)，其中的页在第一次访问时才分配
+// 同一地址空间的区域互不重叠，按地址组织成红黑树
+struct section {
+    u64 flags;
+    u64 begin;
+    u64 end;
+    struct rb_node_ stnode;
+};
+
+void init_sections(struct pgdir *pd);
+int add_section(struct pgdir *pd, u64 begin, u64 end, u64 flags);
+int copy_sections(struct pgdir *dst, struct pgdir *src);
+void free_sections(struct pgdir *pd);
+int pgfault_handler(u64 iss);
+
+u64 mmap(u64 addr, u64 len, int prot, int flags, int fd, u64 offset);
+int munmap(u64 addr, u64 len);
+u64 brk(u64 addr);
+u64 map_kernel_pages(void **pages, usize n);
@@ -6,21 +6,97 @@
 #include <common/string.h>
 #include <kernel/printk.h>
 #include <kernel/cpu.h>
+#include <kernel/paging.h>
+#include <kernel/fpsimd.h>
+#include <kernel/uring.h>
+#include <kernel/systrace.h>
+#include <kernel/rcu.h>
 
 Proc root_proc; // the root process
 SpinLock proc_lock; // lock for process tree
 
 void kernel_entry();
-void proc_entry();
+void kproc_trampoline();
+void uproc_trampoline();
+void trap_return();
 
-int next_pid = 1;
+// PID表：两级基数树，pid的高位选择一页，低位是页内下标
+// 查找只需两次访存；页按需分配，分配后不再释放
+#define PID_PER_PAGE (PAGE_SIZE / sizeof(Proc *))
+#define PID_MAX ((int)(PID_PER_PAGE * PID_PER_PAGE))
+
+static Proc **pid_table[PID_PER_PAGE];
+static SpinLock pid_lock; // 保护PID的分配与释放
+static int last_pid;      // 上一次分配的PID，下一次从它之后开始找，避免立刻复用
+
+// 为进程p分配一个PID并登记到PID表中
+static int alloc_pid(Proc *p)
+{
+    acquire_spinlock(&pid_lock);
+
+    int pid = last_pid;
+    for (int i = 0; i < PID_MAX; i++) {
+        pid = pid + 1 < PID_MAX ? pid + 1 : 1;
+
+        Proc **page = pid_table[pid / PID_PER_PAGE];
+        if (page == NULL) {
+            page = kalloc_page();
+            memset(page, 0, PAGE_SIZE);
+            __atomic_store_n(&pid_table[pid / PID_PER_PAGE], page,
+                             __ATOMIC_RELEASE);
+        }
+
+        if (page[pid % PID_PER_PAGE] == NULL) {
+            __atomic_store_n(&page[pid % PID_PER_PAGE], p, __ATOMIC_RELEASE);
+            last_pid = pid;
+            release_spinlock(&pid_lock);
+            return pid;
+        }
+    }
+
+    printk("alloc_pid: no free pid\n");
+    PANIC();
+}
+
+// 从PID表中注销pid（必须在释放进程之前调用）
+static void free_pid(int pid)
+{
+    acquire_spinlock(&pid_lock);
+    Proc **page = pid_table[pid / PID_PER_PAGE];
+    __atomic_store_n(&page[pid % PID_PER_PAGE], NULL, __ATOMIC_RELEASE);
+    release_spinlock(&pid_lock);
+}
+
+// 每个CPU缓存若干个已回收的进程（连同其内核栈），供create_proc直接复用
+// 内核态不会被抢占，所以访问本CPU的缓存不需要加锁
+#define PROC_CACHE_SIZE 16
+
+static struct {
+    ListNode list; // 通过Proc的ptnode串起来
+    int cnt;
+} proc_cache[NCPU];
+
+// 根据pid查找进程，找不到返回NULL
+// 查找本身不加锁；调用者需要处于RCU读临界区内，进程在宽限期结束前不会被复用或释放
+static Proc *pid_lookup(int pid)
+{
+    if (pid <= 0 || pid >= PID_MAX)
+        return NULL;
+    Proc **page = __atomic_load_n(&pid_table[pid / PID_PER_PAGE], __ATOMIC_ACQUIRE);
+    if (page == NULL)
+        return NULL;
+    return __atomic_load_n(&page[pid % PID_PER_PAGE], __ATOMIC_ACQUIRE);
+}
 
 // 初始化第一个内核进程
 // NOTE: should call after kinit
 void init_kproc()
 {
-    // 初始化进程树的锁
+    // 初始化进程树的锁与PID表的锁
     init_spinlock(&proc_lock);
+    init_spinlock(&pid_lock);
+    for (int i = 0; i < NCPU; i++)
+        init_list_node(&proc_cache[i].list);
 
     // 初始化根进程
     init_proc(&root_proc);
@@ -44,38 +120,85 @@ void init_kproc()
 }
 
 // 初始化新的（用户态）进程
+// NOTE: p->kstack为NULL时会为其分配新的内核栈，否则沿用原来的内核栈
 void init_proc(Proc *p)
 {
-    acquire_spinlock(&proc_lock);
-
     // 初始化进程信息
     p->killed = false;
     p->idle = false;
-    p->pid = next_pid++;
     p->exitcode = 0;
+    p->parent = NULL; // 从缓存复用的进程还留着上一个父进程
     p->state = UNUSED;
+    init_spinlock(&p->lock);
     init_sem(&p->childexit, 0);
     init_list_node(&p->children);
+    init_list_node(&p->zombies);
     init_list_node(&p->ptnode);
 
-    // 初始化调度信息
+    // 初始化调度信息与页表
     init_schinfo(&p->schinfo);
+    init_pgdir(&p->pgdir);
+    p->fpsimd_cpu = -1;
 
-    // 分配内核栈
-    p->kcontext = kalloc_page() + PAGE_SIZE - sizeof(KernelContext);
+    // 分配内核栈：栈顶是从用户态陷入时保存的UserContext，其下是KernelContext
+    if (p->kstack == NULL)
+        p->kstack = kalloc_page();
+    p->ucontext = p->kstack + PAGE_SIZE - sizeof(UserContext);
+    p->kcontext = (void *)p->ucontext - sizeof(KernelContext);
 
-    release_spinlock(&proc_lock);
+    // 最后才登记到PID表：kill()无锁地查表，登记后p随时可能被访问
+    p->pid = alloc_pid(p);
 }
 
-// 创建新的进程
+// 创建新的进程，优先复用本CPU缓存中的进程
 Proc *create_proc()
 {
-    Proc *p = kalloc(sizeof(Proc));
+    Proc *p;
+    auto cache = &proc_cache[cpuid()];
+
+    if (cache->cnt > 0) {
+        ListNode *node = cache->list.next;
+        _detach_from_list(node);
+        cache->cnt--;
+        p = container_of(node, Proc, ptnode);
+    } else {
+        p = kalloc(sizeof(Proc));
+        p->kstack = NULL;
+        p->fpsimd = NULL;
+        p->uring = NULL;
+        p->strace = NULL;
+    }
     init_proc(p);
 
     return p;
 }
 
+// 宽限期结束后放回本CPU的缓存，缓存满了才真正释放内存
+static void free_proc_rcu(struct rcu_head *head)
+{
+    Proc *p = container_of(head, Proc, rcu);
+    auto cache = &proc_cache[cpuid()];
+
+    if (cache->cnt < PROC_CACHE_SIZE) {
+        _insert_into_list(&cache->list, &p->ptnode);
+        cache->cnt++;
+        return;
+    }
+
+    kfree_page(p->kstack);
+    kfree(p);
+}
+
+// 释放已回收的进程（已从PID表中注销）：附属的资源立即释放，
+// Proc本身可能还被kill()这样的无锁读者引用，推迟到宽限期之后
+static void free_proc(Proc *p)
+{
+    fpsimd_free(p);
+    uring_free(p);
+    systrace_free(p);
+    call_rcu(&p->rcu, free_proc_rcu);
+}
+
 // 设置 进程proc 的父进程为当前进程
 // NOTE: it's ensured that the old proc->parent = NULL
 void set_parent_to_this(Proc *proc)
@@ -89,7 +212,7 @@ void set_parent_to_this(Proc *proc)
 
 // 启动进程
 // 1. set the parent to root_proc if NULL
-// 2. setup the kcontext to make the proc start with proc_entry(entry, arg)
+// 2. setup the kcontext to make the proc start with entry(arg)
 // 3. activate the proc and return its pid
 // NOTE: be careful of concurrency
 int start_proc(Proc *p, void (*entry)(u64), u64 arg)
@@ -102,12 +225,13 @@ int start_proc(Proc *p, void (*entry)(u64), u64 arg)
         _insert_into_list(&root_proc.children, &p->ptnode);
     }
 
-    // 设置内核上下文
-    // 从用户态回到内核时，会到proc_entry()函数的首地址
-    // 也即是：调用proc_entry，参数为entry和arg
-    p->kcontext->x0 = (u64)entry;
-    p->kcontext->x1 = (u64)arg;
-    p->kcontext->x30 = (u64)proc_entry;
+    // 设置内核上下文：第一次被换入时swtch返回到跳板
+    // 从trap_return开始的进程直接经由UserContext回到用户态，其余的调用entry(arg)
+    p->kcontext->x19 = (u64)entry;
+    p->kcontext->x20 = (u64)arg;
+    p->kcontext->x30 = entry == (void (*)(u64))trap_return ?
+                               (u64)uproc_trampoline :
+                               (u64)kproc_trampoline;
 
     release_spinlock(&proc_lock);
 
@@ -120,76 +244,63 @@ int start_proc(Proc *p, void (*entry)(u64), u64 arg)
     return p->pid;
 }
 
+// 将链表from上的所有结点整体接到链表to的头部，from变为空链表
+static void splice_list(ListNode *to, ListNode *from)
+{
+    if (_empty_list(from))
+        return;
+    ListNode *first = from->next;
+    _detach_from_list(from); // 摘下哨兵结点，剩下的结点仍然成环
+    _merge_list(to, first);
+}
+
 // 等待子进程退出
 // 如果没有子进程，则返回 -1
 // 保存退出状态到exitcode 并返回其pid
 int wait(int *exitcode)
 {
-    // 调试
-    // printk("process %d is waiting.\n", thisproc()->pid);
-
-    // 打印子进程
-    // printk("children of process %d:\n", thisproc()->pid);
-    ListNode *node = thisproc()->children.next;
-    while (node != &thisproc()->children) {
-        // Proc *child = container_of(node, Proc, ptnode);
-        node = node->next;
-        // printk("  child %d\n", child->pid);
-    }
+    Proc *p = thisproc();
 
     acquire_spinlock(&proc_lock);
 
-    // 如果没有子进程，则返回-1
-    if (_empty_list(&thisproc()->children)) {
-        release_spinlock(&proc_lock);
-        return -1;
-    }
-
     for (;;) {
-        Proc *p = thisproc();
-        ListNode *node = p->children.next;
-
-        // 遍历所有子进程
-        while (node != &p->children) {
-            Proc *child = container_of(node, Proc, ptnode);
-            node = node->next;
-
-            // 如果子进程已经退出，则清理子进程并返回
-            if (is_zombie(child)) {
-                // 调试
-                // printk("process %d 's child process %d is a zombie and will be released.\n",
-                    //    p->pid, child->pid);
-
-                // 保存子进程的pid
-                int child_pid = child->pid;
-
-                // 保存退出状态
-                if (exitcode != 0)
-                    *exitcode = child->exitcode;
-
-                // 从父进程的子进程链表中移除
-                _detach_from_list(&child->ptnode);
-
-                // 释放子进程的资源
-                kfree_page((void *)round_up((u64)child->kcontext - PAGE_SIZE,
-                                            PAGE_SIZE));
-
-                // 释放子进程的内存
-                kfree(child);
+        // 退出的子进程会把自己挂到父进程的zombies上，直接取一个即可
+        if (!_empty_list(&p->zombies)) {
+            Proc *child = container_of(p->zombies.next, Proc, ptnode);
+
+            // 从父进程的僵尸链表中移除，并注销其PID
+            _detach_from_list(&child->ptnode);
+            free_pid(child->pid);
+            release_spinlock(&proc_lock);
+
+            // 子进程从挂上zombies起直到被完全换出都持有自己的锁，
+            // 拿到这把锁就说明它的内核栈已经不再使用
+            acquire_spinlock(&child->lock);
+            release_spinlock(&child->lock);
+
+            // 保存子进程的pid与退出状态
+            int child_pid = child->pid;
+            if (exitcode != 0)
+                *exitcode = child->exitcode;
+
+            // 释放子进程的地址空间，以及子进程本身（连同内核栈一起缓存以便复用）
+            free_sections(&child->pgdir);
+            destroy_pgdir(&child->pgdir);
+            free_proc(child);
+            return child_pid;
+        }
 
-                release_spinlock(&proc_lock);
-                return child_pid;
-            }
+        // 如果没有子进程，则返回-1
+        if (_empty_list(&p->children)) {
+            release_spinlock(&proc_lock);
+            return -1;
         }
 
         // 如果没有子进程退出，则等待
         release_spinlock(&proc_lock);
-        wait_sem(&thisproc()->childexit);
+        wait_sem(&p->childexit);
         acquire_spinlock(&proc_lock);
     }
-
-    printk("Should not reach here!\n");
-    PANIC();
 }
 
 // 退出当前进程, 不会返回
@@ -204,34 +315,75 @@ NO_RETURN void exit(int code)
         PANIC();
     }
 
-    // 如果进程p有子进程，则将其子进程的父进程设置为根进程
-    if (_empty_list(&p->children) == false) {
-        ListNode *node = p->children.next;
-        while (node != &p->children) {
-            Proc *child = container_of(node, Proc, ptnode);
-            node = node->next;
-
-            // 将子进程的父进程设置为根进程
-            child->parent = &root_proc;
-            _insert_into_list(&root_proc.children, &child->ptnode);
-            activate_proc(&root_proc);
-        }
+    acquire_spinlock(&proc_lock);
+
+    // 将活着的子进程转交给根进程：链表整体拼接，但每个子进程的父进程指针仍要逐个改写
+    // 这一步与子进程数成正比（每个只是一次写），不再有逐个插入链表与唤醒根进程
+    ListNode *node = p->children.next;
+    while (node != &p->children) {
+        container_of(node, Proc, ptnode)->parent = &root_proc;
+        node = node->next;
+    }
+    splice_list(&root_proc.children, &p->children);
+
+    // 尚未回收的僵尸子进程整体交给根进程回收
+    if (!_empty_list(&p->zombies)) {
+        splice_list(&root_proc.zombies, &p->zombies);
+        post_sem(&root_proc.childexit);
     }
 
-    post_sem(&p->parent->childexit); // 释放父进程的信号量
     p->exitcode = code; // 设置退出状态
 
-    // 调度进程
+    // 把自己挂到父进程的僵尸链表上
+    _detach_from_list(&p->ptnode);
+    _insert_into_list(&p->parent->zombies, &p->ptnode);
+
+    // 先持有自己的锁再释放proc_lock：父进程在wait()中会等待这把锁，
+    // 从而保证回收时子进程已经完全换出
     acquire_sched_lock();
+    post_sem(&p->parent->childexit); // 释放父进程的信号量
+    release_spinlock(&proc_lock);
+
+    // 调度进程
     sched(ZOMBIE);
 
     printk("Should not reach here!\n");
     PANIC(); // prevent the warning of 'no_return function returns'
 }
 
+// 复制当前进程：子进程与父进程以写时复制的方式共享全部用户页
+// 子进程从系统调用返回0，父进程得到子进程的pid
+int fork()
+{
+    Proc *this = thisproc();
+    Proc *child = create_proc();
+
+    set_parent_to_this(child);
+    copy_sections(&child->pgdir, &this->pgdir);
+    copy_pgdir(&child->pgdir, &this->pgdir);
+
+    fpsimd_fork(child, this);
+    *child->ucontext = *this->ucontext;
+    child->ucontext->x0 = 0;
+
+    return start_proc(child, (void (*)(u64))trap_return, 0);
+}
+
+// 杀死进程：设置killed标记并唤醒睡眠中的进程，使其在返回用户态前退出
+// 成功返回0；pid无效（找不到进程）返回-1
 int kill(int pid)
 {
-    // TODO:
-    // Set the killed flag of the proc to true and return 0.
-    // Return -1 if the pid is invalid (proc not found).
-}
\ No newline at end of file
+    rcu_read_lock();
+
+    Proc *p = pid_lookup(pid);
+    if (p == NULL || p->idle) {
+        rcu_read_unlock();
+        return -1;
+    }
+
+    p->killed = true;
+    alert_proc(p);
+
+    rcu_read_unlock();
+    return 0;
+}
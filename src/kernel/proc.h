@@ -5,6 +5,8 @@
 #include <common/sem.h>
 #include <common/rbtree.h>
 #include <kernel/pt.h>
+#include <aarch64/fpsimd.h>
+#include <kernel/rcu.h>
 
 enum procstate { UNUSED, RUNNABLE, RUNNING, SLEEPING, ZOMBIE };
 
@@ -49,11 +51,8 @@ typedef struct UserContext {
 } UserContext;
 
 typedef struct KernelContext {
-    // TODO: customize your context
-    u64 x0;
-    u64 x1;
-
-
+    // 只保存被调用者保存的寄存器；新进程第一次运行时，
+    // x30指向swtch.S中的跳板，x19/x20为入口函数及其参数
     u64 x19;
     u64 x20;
     u64 x21;
@@ -66,14 +65,13 @@ typedef struct KernelContext {
     u64 x28;
     u64 x29; // Frame Pointer
     u64 x30; // Procedure Link Register
-
-
 } KernelContext;
 
 // embeded data for procs
 struct schinfo {
     // TODO: customize your sched info
     ListNode sched_node; // 串在调度队列中的（代表当前进程的）结点
+    int cpu;             // 只在该CPU上运行，-1表示不限
 };
 
 typedef struct Proc {
@@ -82,8 +80,10 @@ typedef struct Proc {
     int pid;
     int exitcode;
     enum procstate state;       // 进程状态
+    SpinLock lock;              // 进程锁（保护state与调度队列中的成员关系）
     Semaphore childexit;        // 
     ListNode children;          // 子进程列表
+    ListNode zombies;           // 已退出、等待回收的子进程列表
     ListNode ptnode;            // 进程作为子进程时，自己串在链表上的节点。 
     struct Proc *parent;        // 父进程指针
     struct schinfo schinfo;     // 调度信息
@@ -91,6 +91,11 @@ typedef struct Proc {
     void *kstack;               // 内核栈
     UserContext *ucontext;      // 用户态上下文
     KernelContext *kcontext;    // 内核态上下文（也是内核栈开始处，从高到低）
+    FpsimdState *fpsimd;        // FP/SIMD寄存器的保存区，第一次使用时才分配
+    int fpsimd_cpu;             // 最近一次装入其FP/SIMD状态的CPU，-1表示没有
+    struct uring *uring;        // 系统调用提交/完成环，uring_setup时才创建
+    struct syscall_trace *strace; // 系统调用跟踪的记录区，第一次打开跟踪时才分配
+    struct rcu_head rcu;        // 回收后经过一个宽限期才真正释放（kill无锁地查找PID表）
 } Proc;
 
 void init_kproc();
@@ -99,4 +104,5 @@ Proc *create_proc();
 int start_proc(Proc *, void (*entry)(u64), u64 arg);
 NO_RETURN void exit(int code);
 int wait(int *exitcode);
-int kill(int pid);
\ No newline at end of file
+int kill(int pid);
+int fork();
\ No newline at end of file
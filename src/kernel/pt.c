@@ -1,33 +1,579 @@
 #include <kernel/pt.h>
 #include <kernel/mem.h>
+#include <kernel/paging.h>
 #include <common/string.h>
+#include <common/spinlock.h>
 #include <aarch64/intrinsic.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+
+// 保护最后一级页表的共享关系（fork时共享、写时拆分、销毁时放弃引用）
+// 这些操作都需要“读引用计数再决定”，用一把锁避免两方同时认为自己是最后一个持有者
+static SpinLock pt_share_lock;
+
+// ASID分配：按代分配，一代内的ASID用完时开始新的一代并刷新全部TLB
+// 换代时各CPU正在使用的ASID被保留下来，正在运行的地址空间在新一代中沿用原来的ASID
+#define NUM_ASID (1 << ASID_BITS)
+#define ASID_MASK (NUM_ASID - 1)
+#define ASID_GEN(asid) ((asid) & ~(u64)ASID_MASK)
+
+static SpinLock asid_lock;
+static u64 asid_generation = NUM_ASID;  // 当前代号（位于ASID之上的位）
+static u64 asid_map[NUM_ASID / 64];     // 当前一代中已分配的ASID
+static u64 next_asid = 1;               // ASID 0 留给没有用户页表的进程
+static u64 active_asid[NCPU];           // 各CPU正在使用的ASID，换代时被清零
+static u64 reserved_asid[NCPU];         // 换代时各CPU正在使用的ASID
+
+void init_pt()
+{
+    init_spinlock(&pt_share_lock);
+    init_spinlock(&asid_lock);
+}
+
+// 开始新的一代（需持有asid_lock）
+static void new_asid_generation()
+{
+    asid_generation += NUM_ASID;
+    memset(asid_map, 0, sizeof(asid_map));
+
+    for (int i = 0; i < NCPU; i++) {
+        u64 asid = __atomic_exchange_n(&active_asid[i], 0, __ATOMIC_RELAXED);
+        // 该CPU在上一次换代后还没有切换过地址空间，沿用上次保留的ASID
+        if (asid == 0)
+            asid = reserved_asid[i];
+        asid_map[(asid & ASID_MASK) / 64] |= BIT((asid & ASID_MASK) % 64);
+        reserved_asid[i] = asid;
+    }
+
+    arch_tlbi_vmalle1is();
+    next_asid = 1;
+}
+
+// 如果asid是换代时被保留的，则把保留记录更新到新的一代（需持有asid_lock）
+static bool update_reserved_asid(u64 asid, u64 newasid)
+{
+    bool hit = false;
+    for (int i = 0; i < NCPU; i++) {
+        if (reserved_asid[i] == asid) {
+            reserved_asid[i] = newasid;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+// 为asid（可能属于旧的一代或为0）分配当前一代的ASID（需持有asid_lock）
+static u64 new_asid(u64 asid)
+{
+    if (asid != 0) {
+        u64 newasid = asid_generation | (asid & ASID_MASK);
+        if (update_reserved_asid(asid, newasid))
+            return newasid;
+        // 原来的ASID在新一代中还没人用，继续使用它，省得换代后全部重新分配
+        u64 *word = &asid_map[(asid & ASID_MASK) / 64];
+        if (!(*word & BIT((asid & ASID_MASK) % 64))) {
+            *word |= BIT((asid & ASID_MASK) % 64);
+            return newasid;
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (u64 i = next_asid; i < NUM_ASID; i++) {
+            if (!(asid_map[i / 64] & BIT(i % 64))) {
+                asid_map[i / 64] |= BIT(i % 64);
+                next_asid = i + 1;
+                return asid_generation | i;
+            }
+        }
+        new_asid_generation();
+    }
+
+    printk("new_asid: no free asid\n");
+    PANIC();
+}
+
+// 分配一页清零的页表
+static PTEntriesPtr alloc_pt()
+{
+    PTEntriesPtr pt = kalloc_page();
+    memset(pt, 0, PAGE_SIZE);
+    return pt;
+}
+
+// 攒够一批再交还给分配器的页，分配器只需加锁一次
+#define PAGE_BATCH 64
+
+struct page_batch {
+    void *pages[PAGE_BATCH];
+    usize n;
+};
+
+static void batch_release(struct page_batch *b)
+{
+    kfree_pages(b->pages, b->n);
+    b->n = 0;
+}
+
+// 放弃对页page的一次引用；b为NULL时立即放弃，否则先攒进b
+static void batch_put(struct page_batch *b, void *page)
+{
+    if (b == NULL) {
+        kfree_page(page);
+        return;
+    }
+    if (b->n == PAGE_BATCH)
+        batch_release(b);
+    b->pages[b->n++] = page;
+}
+
+// 放弃对最后一级页表pt的一次引用（需持有pt_share_lock）
+// 若是最后一个引用，且put_pages为true，则同时放弃它对所映射物理页的引用
+static void put_pt3(PTEntriesPtr pt, bool put_pages, struct page_batch *b)
+{
+    if (kpage_ref(pt) == 1 && put_pages) {
+        for (int i = 0; i < N_PTE_PER_TABLE; i++) {
+            void *page = (void *)P2K(PTE_ADDRESS(pt[i]));
+            if ((pt[i] & PTE_VALID) && !(pt[i] & PTE_NOREF) &&
+                kpage_ref(page))
+                batch_put(b, page);
+        }
+    }
+    batch_put(b, pt);
+}
+
+// 拆分被共享的最后一级页表，使pde指向一份本页表独占的页表
+// 共享页表中可写的页改为写时复制，双方都要改，因为物理页从此被两张页表引用
+// 拆分自块映射的页（PTE_NOREF）与块映射一样直接共享；
+// 与内核共享的页（PTE_SHARED）保持可写，由双方共同引用
+static void unshare_pt3(PTEntry *pde)
+{
+    acquire_spinlock(&pt_share_lock);
+
+    PTEntriesPtr old = (PTEntriesPtr)P2K(PTE_ADDRESS(*pde));
+    if (kpage_ref(old) > 1) {
+        PTEntriesPtr pt = alloc_pt();
+        for (int i = 0; i < N_PTE_PER_TABLE; i++) {
+            if (!(old[i] & PTE_VALID))
+                continue;
+            if (old[i] & PTE_NOREF) {
+                pt[i] = old[i];
+                continue;
+            }
+            if (!(old[i] & (PTE_RO | PTE_SHARED)))
+                old[i] |= PTE_RO | PTE_COW;
+            pt[i] = old[i];
+            kshare_page((void *)P2K(PTE_ADDRESS(old[i])));
+        }
+        put_pt3(old, false, NULL);
+        old = pt;
+    }
+    *pde = K2P(old) | PTE_TABLE;
+
+    release_spinlock(&pt_share_lock);
+}
+
+// 将第level级（1或2）的块描述符拆分成一张下一级页表，映射的内容与属性不变
+// 拆出的页仍由块映射的调用者管理，标记为PTE_NOREF，解除映射时不放弃引用
+// 先让块描述符失效并刷新TLB，再装入页表（break-before-make），
+// 否则旧的块TLB表项可能与新的页表项同时存在
+static void split_block(struct pgdir *pgdir, PTEntry *pde, int level)
+{
+    PTEntriesPtr pt = alloc_pt();
+    u64 type = level + 1 == 3 ? PTE_PAGE | PTE_NOREF : PTE_BLOCK;
+    u64 flags = PTE_FLAGS(*pde) & ~PTE_TYPE_MASK;
+
+    for (int i = 0; i < N_PTE_PER_TABLE; i++)
+        pt[i] = (PTE_ADDRESS(*pde) + i * LEVEL_SIZE(level + 1)) | flags | type;
+
+    *pde = 0;
+    if (pgdir->asid)
+        flush_pgdir_tlb(pgdir);
+    else
+        arch_tlbi_vmalle1is(); // 没有ASID（内核页表）：表项是全局的
+    *pde = K2P(pt) | PTE_TABLE;
+}
+
+// 返回va在第level级页表中的表项；如果表项不存在（不需要有效），alloc=true时分配途中的页表
+// 途中遇到块映射时：alloc=false直接返回该块描述符，alloc=true则将其拆分后继续
+static PTEntry *walk_pgdir(struct pgdir *pgdir, u64 va, int level, bool alloc)
+{
+    if (pgdir->pt == NULL) {
+        if (!alloc)
+            return NULL;
+        pgdir->pt = alloc_pt();
+    }
+
+    PTEntriesPtr pt = pgdir->pt;
+    for (int i = 0; i < level; i++) {
+        PTEntry *pde = &pt[VA_PART(va, i)];
+        if (!(*pde & PTE_VALID)) {
+            if (!alloc)
+                return NULL;
+            *pde = K2P(alloc_pt()) | PTE_TABLE;
+        } else if (PTE_IS_BLOCK(*pde)) {
+            if (!alloc)
+                return pde;
+            split_block(pgdir, pde, i);
+        }
+        if (alloc && (*pde & PTE_TABLE_RO)) {
+            unshare_pt3(pde);
+            flush_pgdir_tlb(pgdir);
+        }
+        pt = (PTEntriesPtr)P2K(PTE_ADDRESS(*pde));
+    }
+
+    return &pt[VA_PART(va, level)];
+}
 
 PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
 {
-    // TODO:
     // Return a pointer to the PTE (Page Table Entry) for virtual address 'va'
     // If the entry not exists (NEEDN'T BE VALID), allocate it if alloc=true, or return NULL if false.
     // THIS ROUTINUE GETS THE PTE, NOT THE PAGE DESCRIBED BY PTE.
+    // NOTE: alloc=true 表示调用者要修改这个PTE，因此被共享的最后一级页表会先被拆分，
+    //       块映射也会先被拆分成页；alloc=false时若va落在块映射中，返回的是块描述符
+    return walk_pgdir(pgdir, va, 3, alloc);
+}
+
+// 一次遍历中批量分配页表页，每次从分配器取PT_BATCH页，减少分配器加锁的次数
+#define PT_BATCH 16
+
+struct pt_cache {
+    void *pages[PT_BATCH];
+    usize n;
+};
+
+static PTEntriesPtr cache_alloc_pt(struct pt_cache *cache)
+{
+    if (cache->n == 0)
+        cache->n = kalloc_pages(cache->pages, PT_BATCH);
+    if (cache->n == 0)
+        PANIC();
+    PTEntriesPtr pt = cache->pages[--cache->n];
+    memset(pt, 0, PAGE_SIZE);
+    return pt;
+}
+
+static void cache_release(struct pt_cache *cache)
+{
+    while (cache->n > 0)
+        kfree_page(cache->pages[--cache->n]);
+}
+
+// 在第level级页表pt中映射[va, end) -> [pa, ...)，每张页表只访问一次，连续的表项直接填写
+// 返回是否覆盖了原有的有效映射（需要刷新TLB）
+static bool map_level(struct pgdir *pgdir, struct pt_cache *cache,
+                      PTEntriesPtr pt, int level, u64 va, u64 end, u64 pa,
+                      u64 flags)
+{
+    u64 size = LEVEL_SIZE(level);
+    bool replaced = false;
+
+    for (PTEntry *pte = &pt[VA_PART(va, level)]; va < end; pte++) {
+        u64 next = MIN(round_down(va, size) + size, end);
+
+        if (level == 3) {
+            replaced |= *pte & PTE_VALID;
+            *pte = pa | flags | PTE_PAGE;
+        } else if (level > 0 && va % size == 0 && pa % size == 0 &&
+                   next - va == size &&
+                   (!(*pte & PTE_VALID) || PTE_IS_BLOCK(*pte))) {
+            replaced |= *pte & PTE_VALID;
+            *pte = pa | flags | PTE_BLOCK;
+        } else {
+            if (!(*pte & PTE_VALID)) {
+                *pte = K2P(cache_alloc_pt(cache)) | PTE_TABLE;
+            } else if (PTE_IS_BLOCK(*pte)) {
+                split_block(pgdir, pte, level);
+            }
+            if (*pte & PTE_TABLE_RO) {
+                unshare_pt3(pte);
+                replaced = true;
+            }
+            replaced |= map_level(pgdir, cache,
+                                  (PTEntriesPtr)P2K(PTE_ADDRESS(*pte)),
+                                  level + 1, va, next, pa, flags);
+        }
+
+        pa += next - va;
+        va = next;
+    }
+
+    return replaced;
+}
+
+// 将[va, va + len)映射到物理地址[pa, pa + len)，flags为表项属性（如PTE_USER_DATA）
+// 每一段都选用对齐条件允许的最大粒度：1GB块、2MB块或4KB页
+// 整个区间只遍历一次页表，途中缺少的页表批量分配，只在覆盖了原有映射时刷新一次TLB
+// va、pa、len都需要按页对齐；已有下级页表的区域不会被块映射覆盖
+// NOTE: 块映射的物理内存由调用者管理，不参与页引用计数，fork时也直接共享而不是写时复制
+void map_range(struct pgdir *pgdir, u64 va, u64 pa, u64 len, u64 flags)
+{
+    struct pt_cache cache = { .n = 0 };
+
+    if (len == 0)
+        return;
+    if (pgdir->pt == NULL)
+        pgdir->pt = alloc_pt();
+
+    if (map_level(pgdir, &cache, pgdir->pt, 0, va, va + len, pa,
+                  flags & ~PTE_TYPE_MASK))
+        flush_pgdir_tlb(pgdir);
+
+    cache_release(&cache);
+}
+
+// 解除映射的页数不超过这个值时逐页刷新TLB，否则刷新整个ASID
+#define UNMAP_FLUSH_PAGES 64
+
+struct unmap_ctx {
+    struct pgdir *pgdir;
+    struct page_batch batch;
+};
+
+static void unmap_put_page(struct unmap_ctx *ctx, PTEntry pte)
+{
+    void *page = (void *)P2K(PTE_ADDRESS(pte));
+    if ((pte & PTE_NOREF) || !kpage_ref(page))
+        return;
+    if (ctx->batch.n == PAGE_BATCH) {
+        flush_pgdir_tlb(ctx->pgdir);
+        batch_release(&ctx->batch);
+    }
+    ctx->batch.pages[ctx->batch.n++] = page;
+}
+
+// 在第level级页表pt中解除[va, end)的映射，每张页表只访问一次
+static void unmap_level(struct unmap_ctx *ctx, PTEntriesPtr pt, int level,
+                        u64 va, u64 end)
+{
+    u64 size = LEVEL_SIZE(level);
+
+    for (PTEntry *pte = &pt[VA_PART(va, level)]; va < end; pte++) {
+        u64 next = MIN(round_down(va, size) + size, end);
+
+        if (!(*pte & PTE_VALID)) {
+            // nothing mapped here
+        } else if (level == 3) {
+            unmap_put_page(ctx, *pte);
+            *pte = 0;
+        } else if (PTE_IS_BLOCK(*pte) && next - va == size) {
+            *pte = 0;
+        } else {
+            if (PTE_IS_BLOCK(*pte))
+                split_block(ctx->pgdir, pte, level);
+            if (*pte & PTE_TABLE_RO)
+                unshare_pt3(pte);
+            unmap_level(ctx, (PTEntriesPtr)P2K(PTE_ADDRESS(*pte)), level + 1,
+                        va, next);
+        }
+
+        va = next;
+    }
+}
+
+// 解除[va, va + len)的映射，并放弃对其中物理页的引用（块映射除外，见map_range）
+// 整个区间只遍历一次页表，最后统一刷新TLB：小区间逐页发出TLBI、只做一次同步，大区间刷新整个ASID
+// 中间页表即使变空也不释放，留到free_pgdir/destroy_pgdir时一起释放
+void unmap_range(struct pgdir *pgdir, u64 va, u64 len)
+{
+    struct unmap_ctx ctx = { .pgdir = pgdir, .batch.n = 0 };
+
+    if (len == 0 || pgdir->pt == NULL)
+        return;
+
+    unmap_level(&ctx, pgdir->pt, 0, va, va + len);
+
+    if (len / PAGE_SIZE <= UNMAP_FLUSH_PAGES && pgdir->asid) {
+        arch_dsb_sy();
+        for (u64 p = va; p < va + len; p += PAGE_SIZE)
+            arch_tlbi_vae1is_nosync(pgdir->asid & ASID_MASK, p);
+        arch_fence();
+    } else {
+        flush_pgdir_tlb(pgdir);
+    }
+
+    batch_release(&ctx.batch);
 }
 
 void init_pgdir(struct pgdir *pgdir)
 {
     pgdir->pt = NULL;
+    pgdir->asid = 0;
+    init_spinlock(&pgdir->lock);
+    init_sections(pgdir);
+}
+
+// 递归释放第level级页表pt及其下级页表，释放的页攒进b
+static void free_pt(PTEntriesPtr pt, int level, bool put_pages,
+                    struct page_batch *b)
+{
+    if (level == 3) {
+        acquire_spinlock(&pt_share_lock);
+        put_pt3(pt, put_pages, b);
+        release_spinlock(&pt_share_lock);
+        return;
+    }
+
+    for (int i = 0; i < N_PTE_PER_TABLE; i++) {
+        if ((pt[i] & PTE_VALID) && !PTE_IS_BLOCK(pt[i]))
+            free_pt((PTEntriesPtr)P2K(PTE_ADDRESS(pt[i])), level + 1,
+                    put_pages, b);
+    }
+    batch_put(b, pt);
 }
 
 void free_pgdir(struct pgdir *pgdir)
 {
-    // TODO:
     // Free pages used by the page table. If pgdir->pt=NULL, do nothing.
     // DONT FREE PAGES DESCRIBED BY THE PAGE TABLE
+    if (pgdir->pt == NULL)
+        return;
+    flush_pgdir_tlb(pgdir);
+    struct page_batch b = { .n = 0 };
+    free_pt(pgdir->pt, 0, false, &b);
+    batch_release(&b);
+    pgdir->pt = NULL;
+}
+
+// 已销毁、等待空闲CPU释放的地址空间
+struct dead_pgdir {
+    QueueNode node;
+    PTEntriesPtr pt;
+};
+
+static QueueNode *dead_pgdirs;
+
+// 销毁进程的地址空间：释放页表，并放弃对其映射的物理页的引用
+// 与free_pgdir不同，调用者不再持有这些物理页
+// 遍历整棵页表的开销与地址空间大小成正比，因此这里只刷新TLB并将页表挂入队列，
+// 由空闲CPU在reclaim_pgdir中释放，调用者（wait）可以立即返回
+void destroy_pgdir(struct pgdir *pgdir)
+{
+    if (pgdir->pt == NULL)
+        return;
+    // 刷新之后不会再有CPU经由这张页表访问内存，页表可以晚些再释放
+    flush_pgdir_tlb(pgdir);
+    struct dead_pgdir *d = kalloc(sizeof(struct dead_pgdir));
+    d->pt = pgdir->pt;
+    pgdir->pt = NULL;
+    add_to_queue(&dead_pgdirs, &d->node);
+}
+
+// 释放一个已销毁的地址空间，没有待释放的地址空间时返回false
+// 由空闲CPU调用；每次只处理一个，以便尽快回到调度器
+bool reclaim_pgdir()
+{
+    // 整体取出再把其余的放回，避免多个CPU逐个弹出时的ABA问题
+    QueueNode *head = fetch_all_from_queue(&dead_pgdirs);
+    if (head == NULL)
+        return false;
+    for (QueueNode *p = head->next, *next; p; p = next) {
+        next = p->next;
+        add_to_queue(&dead_pgdirs, p);
+    }
+
+    struct dead_pgdir *d = container_of(head, struct dead_pgdir, node);
+    struct page_batch b = { .n = 0 };
+    free_pt(d->pt, 0, true, &b);
+    batch_release(&b);
+    kfree(d);
+    return true;
+}
+
+// 写时复制地复制地址空间：只复制前三级页表，最后一级页表由双方共享，
+// 并通过上一级表项的APTable位禁止双方经由它写入，第一次写时再拆分
+// 因此fork的开销只与映射的2MB区域数有关，与实际页数无关
+// 块映射直接共享（见map_range）
+void copy_pgdir(struct pgdir *dst, struct pgdir *src)
+{
+    if (src->pt == NULL)
+        return;
+
+    acquire_spinlock(&pt_share_lock);
+
+    dst->pt = alloc_pt();
+    PTEntriesPtr s0 = src->pt, d0 = dst->pt;
+    for (int i = 0; i < N_PTE_PER_TABLE; i++) {
+        if (!(s0[i] & PTE_VALID))
+            continue;
+        PTEntriesPtr s1 = (PTEntriesPtr)P2K(PTE_ADDRESS(s0[i]));
+        PTEntriesPtr d1 = alloc_pt();
+        d0[i] = K2P(d1) | PTE_TABLE;
+
+        for (int j = 0; j < N_PTE_PER_TABLE; j++) {
+            if (!(s1[j] & PTE_VALID))
+                continue;
+            if (PTE_IS_BLOCK(s1[j])) {
+                d1[j] = s1[j];
+                continue;
+            }
+            PTEntriesPtr s2 = (PTEntriesPtr)P2K(PTE_ADDRESS(s1[j]));
+            PTEntriesPtr d2 = alloc_pt();
+            d1[j] = K2P(d2) | PTE_TABLE;
+
+            for (int k = 0; k < N_PTE_PER_TABLE; k++) {
+                if (!(s2[k] & PTE_VALID))
+                    continue;
+                if (PTE_IS_BLOCK(s2[k])) {
+                    d2[k] = s2[k];
+                    continue;
+                }
+                s2[k] |= PTE_TABLE_RO;
+                d2[k] = s2[k];
+                kshare_page((void *)P2K(PTE_ADDRESS(s2[k])));
+            }
+        }
+    }
+
+    release_spinlock(&pt_share_lock);
+
+    // 源地址空间失去了写权限，需要清除旧的TLB表项
+    flush_pgdir_tlb(src);
 }
 
+// 切换到地址空间pgdir：TLB表项按ASID区分，切换时不需要刷新TLB
 void attach_pgdir(struct pgdir *pgdir)
 {
     extern PTEntries invalid_pt;
-    if (pgdir->pt)
-        arch_set_ttbr0(K2P(pgdir->pt));
-    else
-        arch_set_ttbr0(K2P(&invalid_pt));
+    if (pgdir->pt == NULL) {
+        // 没有用户页表，invalid_pt中没有任何映射，用ASID 0即可
+        arch_set_ttbr0_asid(K2P(&invalid_pt), 0);
+        return;
+    }
+
+    usize cpu = cpuid();
+    u64 asid = __atomic_load_n(&pgdir->asid, __ATOMIC_RELAXED);
+    u64 old_active = __atomic_load_n(&active_asid[cpu], __ATOMIC_RELAXED);
+
+    // 快速路径：ASID属于当前一代，且没有其他CPU正在换代（换代会清零active_asid）
+    if (old_active == 0 ||
+        ASID_GEN(asid) != __atomic_load_n(&asid_generation, __ATOMIC_RELAXED) ||
+        !__atomic_compare_exchange_n(&active_asid[cpu], &old_active, asid, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        acquire_spinlock(&asid_lock);
+        asid = pgdir->asid;
+        if (ASID_GEN(asid) != asid_generation) {
+            asid = new_asid(asid);
+            pgdir->asid = asid;
+        }
+        __atomic_store_n(&active_asid[cpu], asid, __ATOMIC_RELAXED);
+        release_spinlock(&asid_lock);
+    }
+
+    arch_set_ttbr0_asid(K2P(pgdir->pt), asid & ASID_MASK);
+}
+
+// 刷新地址空间pgdir的全部TLB表项
+void flush_pgdir_tlb(struct pgdir *pgdir)
+{
+    if (pgdir->asid)
+        arch_tlbi_aside1is(pgdir->asid & ASID_MASK);
+}
+
+// 刷新地址空间pgdir中页va的TLB表项
+void flush_pgdir_va(struct pgdir *pgdir, u64 va)
+{
+    if (pgdir->asid)
+        arch_tlbi_vae1is(pgdir->asid & ASID_MASK, va);
 }
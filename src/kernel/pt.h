@@ -1,11 +1,28 @@
 #pragma once
 
 #include <aarch64/mmu.h>
+#include <common/rbtree.h>
+#include <common/spinlock.h>
 
 struct pgdir {
     PTEntriesPtr pt;
+    u64 asid; // 低ASID_BITS位为ASID，更高的位为分配时的代号，0表示尚未分配
+    SpinLock lock;                // 保护以下字段
+    struct rb_root_ section_root; // 地址空间中的区域（struct section），缺页时按需分配
+    u64 heap_begin, brk;          // 堆的起始地址与当前堆顶
 };
 
+void init_pt();
+void init_kernel_pt(u64 memtop);
+void load_kernel_pt();
+PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
+void map_range(struct pgdir *pgdir, u64 va, u64 pa, u64 len, u64 flags);
+void unmap_range(struct pgdir *pgdir, u64 va, u64 len);
 void init_pgdir(struct pgdir *pgdir);
 void free_pgdir(struct pgdir *pgdir);
+void destroy_pgdir(struct pgdir *pgdir);
+bool reclaim_pgdir();
+void copy_pgdir(struct pgdir *dst, struct pgdir *src);
 void attach_pgdir(struct pgdir *pgdir);
+void flush_pgdir_tlb(struct pgdir *pgdir);
+void flush_pgdir_va(struct pgdir *pgdir, u64 va);
@@ -0,0 +1,91 @@
+#include <kernel/rcu.h>
+#include <kernel/cpu.h>
+
+static u64 rcu_epoch;
+
+// 每个CPU的状态，只由本CPU修改（seen、idle也会被其他CPU读）
+static struct {
+    u64 seen;              // 最近一次静止状态时看到的全局纪元
+    bool idle;             // 正在idle中等待中断，推进纪元时不必等它
+    struct rcu_head *head; // 待执行的回调，按登记顺序排列
+    struct rcu_head *tail;
+} __attribute__((aligned(64))) rcu_cpu[NCPU];
+
+// 报告本CPU处于静止状态；若所有在线CPU都已看到当前纪元，则推进纪元
+// 在sched()中调用，不获取任何锁
+void rcu_quiescent()
+{
+    usize cpu = cpuid();
+    // idle中的中断处理可能直接调度到别的进程，此时也要先退出idle
+    if (rcu_cpu[cpu].idle)
+        rcu_idle_exit();
+    u64 epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE);
+    if (rcu_cpu[cpu].seen == epoch)
+        return;
+    // release：本CPU此前的读临界区先于这次报告
+    __atomic_store_n(&rcu_cpu[cpu].seen, epoch, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < NCPU; i++) {
+        if (cpus[i].online &&
+            !__atomic_load_n(&rcu_cpu[i].idle, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&rcu_cpu[i].seen, __ATOMIC_ACQUIRE) != epoch)
+            return;
+    }
+    __atomic_compare_exchange_n(&rcu_epoch, &epoch, epoch + 1, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+// 本CPU即将在idle中睡眠：报告静止状态，并标记为idle，
+// 之后其他CPU推进纪元时不再等它被时钟中断唤醒
+// 若本CPU还有回调且纪元刚被推进（其他CPU都在idle），返回false，调用者应先去执行回调
+bool rcu_idle_enter()
+{
+    auto c = &rcu_cpu[cpuid()];
+    u64 epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE);
+    rcu_quiescent();
+    if (c->head != NULL && __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE) != epoch)
+        return false;
+    __atomic_store_n(&c->idle, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+// 本CPU从idle中醒来，在进入任何读临界区之前调用
+// 不更新seen：醒来后开始的读者要等本CPU下一次经过sched()才算结束
+void rcu_idle_exit()
+{
+    __atomic_store_n(&rcu_cpu[cpuid()].idle, false, __ATOMIC_RELAXED);
+    // 保证清除idle先于之后的读操作被其他CPU看到
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// 登记一个回调，在当前所有读者都离开读临界区之后，由本CPU调用func(head)
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+    auto c = &rcu_cpu[cpuid()];
+    head->next = NULL;
+    head->func = func;
+    head->epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE);
+    if (c->head == NULL)
+        c->head = head;
+    else
+        c->tail->next = head;
+    c->tail = head;
+
+    rcu_process();
+}
+
+// 执行本CPU上宽限期已过的回调，返回是否执行了回调
+// 调用者不能持有回调可能获取的锁（在idle与call_rcu中调用）
+bool rcu_process()
+{
+    auto c = &rcu_cpu[cpuid()];
+    bool ran = false;
+    while (c->head != NULL &&
+           c->head->epoch + 2 <= __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE)) {
+        struct rcu_head *head = c->head;
+        c->head = head->next;
+        head->func(head);
+        ran = true;
+    }
+    return ran;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <common/defines.h>
+#include <aarch64/intrinsic.h>
+
+// 基于纪元（epoch）的轻量RCU
+// 内核态不会被抢占，读者也不会在读临界区内睡眠，所以读临界区本身什么都不用做；
+// 一个CPU进入sched()或idle就说明它已不在任何读临界区内（静止状态）
+// 在idle中睡眠的CPU（rcu_idle_enter与rcu_idle_exit之间）也处于静止状态，不必等它醒来
+// 所有在线CPU都经过一次静止状态，全局纪元加一；在纪元g时登记的回调，
+// 等纪元到达g + 2时（之间完整地经过了一个宽限期）才执行
+//
+// 读者：rcu_read_lock(); p = __atomic_load_n(&ptr, __ATOMIC_ACQUIRE); ... rcu_read_unlock();
+// 写者：先让对象不可达（发布时用release写），再call_rcu推迟释放
+
+struct rcu_head {
+    struct rcu_head *next;
+    u64 epoch; // 登记时的全局纪元
+    void (*func)(struct rcu_head *);
+};
+
+static INLINE void rcu_read_lock()
+{
+    compiler_fence();
+}
+
+static INLINE void rcu_read_unlock()
+{
+    compiler_fence();
+}
+
+void rcu_quiescent();
+bool rcu_idle_enter();
+void rcu_idle_exit();
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+bool rcu_process();
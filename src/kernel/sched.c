@@ -4,11 +4,11 @@
 #include <kernel/printk.h>
 #include <aarch64/intrinsic.h>
 #include <kernel/cpu.h>
+#include <kernel/fpsimd.h>
+#include <kernel/rcu.h>
 #include <common/rbtree.h>
 
 extern bool panic_flag; // 是否处于恐慌状态
-extern SpinLock proc_lock; // 进程树的锁
-static SpinLock sched_lock; // 调度器的锁（防止多个CPU同时尝试调度）
 static Queue sched_queue; // 调度队列
 
 extern void swtch(KernelContext **old_ctx, KernelContext *new_ctx);
@@ -16,7 +16,6 @@ extern void swtch(KernelContext **old_ctx, KernelContext *new_ctx);
 // 初始化调度器
 void init_sched()
 {
-    init_spinlock(&sched_lock); // 初始化调度器的锁
     queue_init(&sched_queue); // 初始化调度队列
 }
 
@@ -29,56 +28,56 @@ Proc *thisproc()
 // 为每个新进程，初始化自定义的schinfo
 void init_schinfo(struct schinfo *p)
 {
-    return;
+    p->cpu = -1;
 }
 
+// 调度锁即当前进程自己的锁：
+// 持有它的进程从修改自身状态起，直到被完全换出为止，都不会被其他CPU选中
 void acquire_sched_lock()
 {
-    acquire_spinlock(&sched_lock);
+    acquire_spinlock(&thisproc()->lock);
 }
 void release_sched_lock()
 {
-    release_spinlock(&sched_lock);
+    release_spinlock(&thisproc()->lock);
 }
 
-// 判断进程是否为僵尸进程
+// 判断进程是否为僵尸进程（只读一个字段，不需要加锁）
 bool is_zombie(Proc *p)
 {
-    bool r;
-    acquire_sched_lock();
-    r = p->state == ZOMBIE;
-    release_sched_lock();
-    return r;
+    return __atomic_load_n(&p->state, __ATOMIC_ACQUIRE) == ZOMBIE;
 }
 
 bool is_unused(Proc *p)
 {
-    bool r;
-    acquire_sched_lock();
-    r = p->state == UNUSED;
-    release_sched_lock();
-    return r;
+    return __atomic_load_n(&p->state, __ATOMIC_ACQUIRE) == UNUSED;
 }
 
 // 激活进程
 // if the proc->state is RUNNING/RUNNABLE, do nothing
 // if the proc->state if SLEEPING/UNUSED, set the process state to RUNNABLE and add it to the sched queue
 // else: panic
-bool activate_proc(Proc *p)
+// onalert为true时（如kill唤醒），目标进程可能已经退出或尚未启动，此时什么也不做
+bool _activate_proc(Proc *p, bool onalert)
 {
-    if (p->state == RUNNING || p->state == RUNNABLE)
+    acquire_spinlock(&p->lock);
+
+    if (p->state == RUNNING || p->state == RUNNABLE) {
+        release_spinlock(&p->lock);
         return true;
+    }
+    if (onalert && (p->state == ZOMBIE || p->state == UNUSED)) {
+        release_spinlock(&p->lock);
+        return false;
+    }
     if (p->state == SLEEPING || p->state == UNUSED) {
-        // 设置进程状态为RUNNABLE
-        acquire_spinlock(&proc_lock);
+        // 设置进程状态为RUNNABLE，并将进程加入调度队列
         p->state = RUNNABLE;
-        release_spinlock(&proc_lock);
-
-        // 将进程加入调度队列
         queue_lock(&sched_queue);
         queue_push(&sched_queue, &p->schinfo.sched_node);
         queue_unlock(&sched_queue);
 
+        release_spinlock(&p->lock);
         return true;
     }
 
@@ -87,46 +86,74 @@ bool activate_proc(Proc *p)
     return false;
 }
 
-// 更新进程状态
-static void update_this_state(enum procstate new_state)
+// 批量激活procs中的n个进程（用于一次唤醒多个等待者）
+// 逐个持有进程锁把睡眠中的进程改为RUNNABLE，再在一次持有队列锁的过程中把它们全部放入调度队列
+// 两步之间进程已是RUNNABLE但还不在队列中：没有人会因此调度它，其他激活者看到RUNNABLE也直接返回
+// NOTE: procs会被改写
+void activate_procs(Proc **procs, int n)
 {
-    acquire_spinlock(&proc_lock);
-
-    // 更新当前进程的状态
-    Proc *p = thisproc();
-    p->state = new_state;
-
-    // 如果进程处于SLEEPING或ZOMBIE状态，将其从调度队列中移除
-    if (new_state == SLEEPING || new_state == ZOMBIE) {
-        queue_lock(&sched_queue);
-        queue_detach(&sched_queue, &p->schinfo.sched_node);
-        queue_unlock(&sched_queue);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        Proc *p = procs[i];
+        acquire_spinlock(&p->lock);
+        if (p->state == SLEEPING || p->state == UNUSED) {
+            p->state = RUNNABLE;
+            procs[k++] = p;
+        } else if (p->state != RUNNING && p->state != RUNNABLE) {
+            printk("activate_procs: unexpected state %d\n", p->state);
+            PANIC();
+        }
+        release_spinlock(&p->lock);
     }
+    if (k == 0)
+        return;
 
-    release_spinlock(&proc_lock);
+    queue_lock(&sched_queue);
+    for (int i = 0; i < k; i++)
+        queue_push(&sched_queue, &procs[i]->schinfo.sched_node);
+    queue_unlock(&sched_queue);
 }
 
-// 从调度队列中选择下一个运行的进程，如果没有可运行的进程，则返回idle进程
-static Proc *pick_next()
+// 更新当前进程的状态，并从调度队列中选择下一个运行的进程，如果没有可运行的进程，则返回idle进程
+// （需要持有当前进程的锁）状态更新与选择在同一次持有队列锁的过程中完成
+// 返回时已持有所选进程的锁（若选中的是当前进程，则它的锁本来就已持有）
+static Proc *pick_next(Proc *this, enum procstate new_state)
 {
-    // 如果调度队列为空，返回idle进程
+    Proc *idle = cpus[cpuid()].sched.idle;
+    int cpu = cpuid();
+
+    this->state = new_state;
+
+    queue_lock(&sched_queue);
+    // 如果进程处于SLEEPING或ZOMBIE状态，将其从调度队列中移除
+    if (new_state == SLEEPING || new_state == ZOMBIE)
+        queue_detach(&sched_queue, &this->schinfo.sched_node);
+
     if (queue_empty(&sched_queue)) {
-        return cpus[cpuid()].sched.idle;
+        queue_unlock(&sched_queue);
+        goto pick_idle;
     }
 
     // 从调度队列中选择下一个进程
-    queue_lock(&sched_queue);
     ListNode *node = queue_front(&sched_queue);
     for (;;) {
         ListNode *next = node->next;
         Proc *p = container_of(node, Proc, schinfo.sched_node);
 
-        // 如果找到了一个RUNNABLE的进程，则将其移到队列尾部，并返回
-        if (p->state == RUNNABLE) {
-            queue_detach(&sched_queue, node);
-            queue_push(&sched_queue, node);
-            queue_unlock(&sched_queue);
-            return p;
+        // 拿不到锁说明该进程正在别的CPU上被换出或被唤醒，跳过它而不是等待，
+        // 以免两个CPU互相等待对方的锁
+        // 绑定到其他CPU的进程也跳过
+        if ((p->schinfo.cpu < 0 || p->schinfo.cpu == cpu) &&
+            (p == this || try_acquire_spinlock(&p->lock))) {
+            // 如果找到了一个RUNNABLE的进程，则将其移到队列尾部，并返回
+            if (p->state == RUNNABLE) {
+                queue_detach(&sched_queue, node);
+                queue_push(&sched_queue, node);
+                queue_unlock(&sched_queue);
+                return p;
+            }
+            if (p != this)
+                release_spinlock(&p->lock);
         }
 
         // 如果已经遍历了整个队列，则break，否则下一个节点
@@ -138,19 +165,23 @@ static Proc *pick_next()
     }
     queue_unlock(&sched_queue);
 
+pick_idle:
     // 如果没有找到RUNNABLE的进程，则返回idle进程
-    return cpus[cpuid()].sched.idle;
+    if (idle != this)
+        acquire_spinlock(&idle->lock);
+    return idle;
 }
 
-// 更新 进程p 为当前CPU正在执行的进程
-static void update_this_proc(Proc *p)
+// 换入后的收尾：释放被换出进程的锁，以及换出方替我们获取的锁
+// 新进程第一次运行时由swtch.S中的跳板调用
+void finish_switch()
 {
-    acquire_spinlock(&proc_lock);
-    cpus[cpuid()].sched.current = p;
-    release_spinlock(&proc_lock);
+    Proc *prev = cpus[cpuid()].sched.prev;
+    release_spinlock(&prev->lock);
+    release_sched_lock();
 }
 
-// 调度器（需要调度队列的锁）
+// 调度器（需要持有当前进程的锁，即acquire_sched_lock()）
 // 选择下一个进程并切换到该进程
 void sched(enum procstate new_state)
 {
@@ -158,27 +189,24 @@ void sched(enum procstate new_state)
 
     ASSERT(this->state == RUNNING);
 
-    update_this_state(new_state);
-
-    auto next = pick_next();
+    rcu_quiescent();
 
-    update_this_proc(next);
+    auto next = pick_next(this, new_state);
 
     ASSERT(next->state == RUNNABLE);
 
     next->state = RUNNING;
 
     if (next != this) {
+        cpus[cpuid()].sched.current = next;
+        cpus[cpuid()].sched.prev = this;
         attach_pgdir(&next->pgdir);
+        fpsimd_switch(this, next);
         swtch(&this->kcontext, next->kcontext);
+        finish_switch();
+        return;
     }
 
     release_sched_lock();
 }
 
-u64 proc_entry(void (*entry)(u64), u64 arg)
-{
-    release_sched_lock();
-    set_return_addr(entry); // 设置返回地址为entry
-    return arg;
-}
@@ -5,12 +5,16 @@
 void init_sched();
 void init_schinfo(struct schinfo *);
 
-bool activate_proc(Proc *);
+bool _activate_proc(Proc *, bool onalert);
+#define activate_proc(proc) _activate_proc(proc, false)
+#define alert_proc(proc) _activate_proc(proc, true)
+void activate_procs(Proc **procs, int n);
 bool is_zombie(Proc *);
 bool is_unused(Proc *);
 void acquire_sched_lock();
 void release_sched_lock();
 void sched(enum procstate new_state);
+void finish_switch();
 
 // MUST call lock_for_sched() before sched() !!!
 #define yield() (acquire_sched_lock(), sched(RUNNABLE))
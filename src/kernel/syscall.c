@@ -1,5 +1,8 @@
 #include <kernel/syscall.h>
 #include <kernel/sched.h>
+#include <kernel/paging.h>
+#include <kernel/uring.h>
+#include <kernel/systrace.h>
 #include <kernel/printk.h>
 #include <common/sem.h>
 #include <test/test.h>
@@ -8,17 +11,68 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Woverride-init"
 
+static u64 syscall_fork()
+{
+    return (u64)(i64)fork();
+}
+
+static u64 syscall_mmap(u64 addr, u64 len, u64 prot, u64 flags, u64 fd,
+                        u64 offset)
+{
+    return mmap(addr, len, (int)prot, (int)flags, (int)fd, offset);
+}
+
+static u64 syscall_munmap(u64 addr, u64 len)
+{
+    return (u64)(i64)munmap(addr, len);
+}
+
+static u64 syscall_brk(u64 addr)
+{
+    return brk(addr);
+}
+
+static u64 syscall_uring_setup(u64 entries)
+{
+    return uring_setup(entries);
+}
+
+static u64 syscall_uring_enter(u64 to_submit)
+{
+    return (u64)uring_enter(to_submit);
+}
+
 void *syscall_table[NR_SYSCALL] = {
     [0 ... NR_SYSCALL - 1] = NULL,
+    [SYS_brk] = (void *)syscall_brk,
+    [SYS_munmap] = (void *)syscall_munmap,
+    [SYS_fork] = (void *)syscall_fork,
+    [SYS_mmap] = (void *)syscall_mmap,
+    [SYS_uring_setup] = (void *)syscall_uring_setup,
+    [SYS_uring_enter] = (void *)syscall_uring_enter,
     [SYS_myreport] = (void *)syscall_myreport,
 };
 
 void syscall_entry(UserContext *context)
 {
-    // TODO
     // Invoke syscall_table[id] with args and set the return value.
     // id is stored in x8. args are stored in x0-x5. return value is stored in x0.
-    // be sure to check the range of id. if id >= NR_SYSCALL, panic.
+    u64 id = context->x8;
+    // x8 comes straight from user space: fail an unknown id with -1, never PANIC.
+    if (id >= NR_SYSCALL || syscall_table[id] == NULL) {
+        printk("Unknown syscall %llu\n", id);
+        context->x0 = (u64)-1;
+        return;
+    }
+
+    if (systrace_active) {
+        systrace_call(context, syscall_table[id]);
+        return;
+    }
+
+    u64 (*func)(u64, u64, u64, u64, u64, u64) = syscall_table[id];
+    context->x0 = func(context->x0, context->x1, context->x2, context->x3,
+                       context->x4, context->x5);
 }
 
 #pragma GCC diagnostic pop
\ No newline at end of file
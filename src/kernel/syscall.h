@@ -3,4 +3,6 @@
 
 #define NR_SYSCALL 512
 
+extern void *syscall_table[NR_SYSCALL];
+
 void syscall_entry(UserContext *context);
\ No newline at end of file
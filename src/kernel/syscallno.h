@@ -1,3 +1,9 @@
 #pragma once
 
+#define SYS_brk 214
+#define SYS_munmap 215
+#define SYS_fork 220
+#define SYS_mmap 222
+#define SYS_uring_setup 425
+#define SYS_uring_enter 426
 #define SYS_myreport 499
\ No newline at end of file
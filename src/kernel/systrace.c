@@ -0,0 +1,176 @@
+#include <kernel/systrace.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <kernel/cpu.h>
+#include <aarch64/intrinsic.h>
+#include <common/string.h>
+#include <common/seqlock.h>
+
+struct syscall_stat {
+    u64 count;
+    u64 ticks;
+    u32 hist[SYSTRACE_BUCKETS];
+};
+
+// 每个CPU一份，只由本CPU在内核中（不会被打断）更新，不需要锁
+// seq让打印时能读到某个调用号一致的一份（次数、总耗时与直方图相符）
+static struct syscall_stat stats[NCPU][NR_SYSCALL];
+static SeqCount stats_seq[NCPU];
+static bool stats_on;
+
+// 打开统计记一次，每个打开跟踪的进程各记一次
+volatile u32 systrace_active;
+
+static int hist_bucket(u64 ticks)
+{
+    int b = ticks ? 63 - __builtin_clzll(ticks) : 0;
+    return MIN(b, SYSTRACE_BUCKETS - 1);
+}
+
+// 带计时地执行一次系统调用，再按需记入统计与当前进程的跟踪
+void systrace_call(UserContext *context, void *func)
+{
+    u64 (*f)(u64, u64, u64, u64, u64, u64) = func;
+    u64 id = context->x8;
+    u64 args[6] = { context->x0, context->x1, context->x2,
+                    context->x3, context->x4, context->x5 };
+
+    u64 start = get_timestamp();
+    u64 ret = f(args[0], args[1], args[2], args[3], args[4], args[5]);
+    u64 ticks = get_timestamp() - start;
+    context->x0 = ret;
+
+    // 调用可能睡眠后换到了别的CPU上，记在结束时所在的CPU
+    if (stats_on) {
+        usize cpu = cpuid();
+        struct syscall_stat *s = &stats[cpu][id];
+        write_seqcount_begin(&stats_seq[cpu]);
+        s->count++;
+        s->ticks += ticks;
+        s->hist[hist_bucket(ticks)]++;
+        write_seqcount_end(&stats_seq[cpu]);
+    }
+
+    struct syscall_trace *t = thisproc()->strace;
+    if (t != NULL && t->on) {
+        struct syscall_record *r = &t->rec[t->next % SYSTRACE_RECORDS];
+        r->id = id;
+        memcpy(r->args, args, sizeof(args));
+        r->ret = ret;
+        r->ticks = ticks;
+        t->next++;
+    }
+}
+
+void systrace_stats_enable(bool on)
+{
+    if (stats_on == on)
+        return;
+    stats_on = on;
+    if (on)
+        __atomic_fetch_add(&systrace_active, 1, __ATOMIC_RELEASE);
+    else
+        __atomic_fetch_sub(&systrace_active, 1, __ATOMIC_RELEASE);
+}
+
+// 只应在统计关闭时调用
+void systrace_stats_reset()
+{
+    memset(stats, 0, sizeof(stats));
+}
+
+// 汇总各CPU上调用号id的统计；其他CPU可能同时在更新，每个CPU的那一份各自是一致的
+static void stats_sum(u64 id, struct syscall_stat *sum)
+{
+    struct syscall_stat s;
+    memset(sum, 0, sizeof(*sum));
+    for (int c = 0; c < NCPU; c++) {
+        u32 seq;
+        do {
+            seq = read_seqbegin(&stats_seq[c]);
+            s = stats[c][id];
+        } while (read_seqretry(&stats_seq[c], seq));
+
+        sum->count += s.count;
+        sum->ticks += s.ticks;
+        for (int b = 0; b < SYSTRACE_BUCKETS; b++)
+            sum->hist[b] += s.hist[b];
+    }
+}
+
+// 返回统计到的调用号id的调用次数
+u64 systrace_stats_count(u64 id)
+{
+    struct syscall_stat sum;
+    stats_sum(id, &sum);
+    return sum.count;
+}
+
+// 汇总各CPU的统计并打印
+void systrace_stats_dump()
+{
+    printk("syscall stats (ticks):\n");
+    for (u64 id = 0; id < NR_SYSCALL; id++) {
+        struct syscall_stat sum;
+        stats_sum(id, &sum);
+        if (sum.count == 0)
+            continue;
+
+        printk("  %llu: %llu calls, %llu ticks, avg %llu\n", id, sum.count,
+               sum.ticks, sum.ticks / sum.count);
+        for (int b = 0; b < SYSTRACE_BUCKETS; b++) {
+            if (sum.hist[b] != 0)
+                printk("      [2^%d, 2^%d) %u\n", b, b + 1, sum.hist[b]);
+        }
+    }
+}
+
+// 打开或关闭进程p的跟踪；记录区第一次打开时分配，进程回收时释放
+void systrace_proc_enable(Proc *p, bool on)
+{
+    if (p->strace == NULL) {
+        if (!on)
+            return;
+        p->strace = kalloc_page();
+        p->strace->on = false;
+        p->strace->next = 0;
+    }
+    if (p->strace->on == on)
+        return;
+    p->strace->on = on;
+    if (on)
+        __atomic_fetch_add(&systrace_active, 1, __ATOMIC_RELEASE);
+    else
+        __atomic_fetch_sub(&systrace_active, 1, __ATOMIC_RELEASE);
+}
+
+// 按时间顺序打印进程p最近的系统调用
+void systrace_proc_dump(Proc *p)
+{
+    struct syscall_trace *t = p->strace;
+    if (t == NULL) {
+        printk("pid %d: not traced\n", p->pid);
+        return;
+    }
+
+    usize first = t->next > SYSTRACE_RECORDS ? t->next - SYSTRACE_RECORDS : 0;
+    printk("pid %d: %llu syscalls, last %llu:\n", p->pid, (u64)t->next,
+           (u64)(t->next - first));
+    for (usize i = first; i < t->next; i++) {
+        struct syscall_record *r = &t->rec[i % SYSTRACE_RECORDS];
+        printk("  %llu(%llx, %llx, %llx, %llx, %llx, %llx) = %lld, %llu ticks\n",
+               r->id, r->args[0], r->args[1], r->args[2], r->args[3],
+               r->args[4], r->args[5], (i64)r->ret, r->ticks);
+    }
+}
+
+void systrace_free(Proc *p)
+{
+    if (p->strace == NULL)
+        return;
+    systrace_proc_enable(p, false);
+    kfree_page(p->strace);
+    p->strace = NULL;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <common/defines.h>
+#include <kernel/syscall.h>
+
+// 系统调用的统计与跟踪，默认关闭，运行时打开：
+//   统计：每个CPU上每个系统调用号的调用次数、总耗时与耗时的log2直方图
+//   跟踪：为单个进程记录最近的系统调用（调用号、参数、返回值、耗时），写满后覆盖最旧的记录
+// 耗时的单位是CNTPCT的计数
+// 统计或跟踪打开时systrace_active非零，trap.S中的快速路径据此退回完整路径
+
+#define SYSTRACE_BUCKETS 20 // 最后一个桶收纳2^19个计数以上的调用
+
+struct syscall_record {
+    u64 id;
+    u64 args[6];
+    u64 ret;
+    u64 ticks;
+};
+
+struct syscall_trace {
+    bool on;
+    usize next; // 已写入的记录总数
+    struct syscall_record rec[];
+};
+
+#define SYSTRACE_RECORDS \
+    ((PAGE_SIZE - sizeof(struct syscall_trace)) / sizeof(struct syscall_record))
+
+struct Proc;
+
+extern volatile u32 systrace_active;
+
+void systrace_call(UserContext *context, void *func);
+void systrace_stats_enable(bool on);
+void systrace_stats_reset();
+u64 systrace_stats_count(u64 id);
+void systrace_stats_dump();
+void systrace_proc_enable(struct Proc *p, bool on);
+void systrace_proc_dump(struct Proc *p);
+void systrace_free(struct Proc *p);
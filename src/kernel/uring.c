@@ -0,0 +1,143 @@
+#include <kernel/uring.h>
+#include <kernel/syscall.h>
+#include <kernel/paging.h>
+#include <kernel/sched.h>
+#include <kernel/mem.h>
+#include <common/string.h>
+
+// 提交项数组紧跟在共享头之后，按表项大小对齐，表项不会跨页
+#define SQES_OFF 64
+#define URING_MAX_PAGES \
+    ((SQES_OFF + URING_MAX_ENTRIES * (sizeof(struct uring_sqe) + \
+                                      2 * sizeof(struct uring_cqe)) + \
+      PAGE_SIZE - 1) / PAGE_SIZE)
+
+// 内核一侧的环：表项数与内核读写的下标都以这里为准，共享页中的值只是给进程看的，
+// 进程改写它们最多让自己的调用出错，不会让内核越界
+struct uring {
+    u32 sq_entries, cq_entries;
+    u32 sq_head, cq_tail;
+    usize npages;
+    void *pages[URING_MAX_PAGES];
+};
+
+static void uring_free_ring(struct uring *r)
+{
+    for (usize i = 0; i < r->npages; i++)
+        kfree_page(r->pages[i]);
+    kfree(r);
+}
+
+// 环中偏移off处的内核地址
+static void *ring_at(struct uring *r, u64 off)
+{
+    return r->pages[off / PAGE_SIZE] + off % PAGE_SIZE;
+}
+
+static u64 cqes_off(struct uring *r)
+{
+    return SQES_OFF + r->sq_entries * sizeof(struct uring_sqe);
+}
+
+// 为当前进程创建提交/完成环，entries向上取整为2的幂，完成环的大小是其两倍
+// 成功返回环在进程中的地址，失败（已有环或entries非法）返回-1
+u64 uring_setup(u64 entries)
+{
+    Proc *p = thisproc();
+    if (p->uring != NULL || entries == 0 || entries > URING_MAX_ENTRIES)
+        return (u64)-1;
+
+    struct uring *r = kalloc(sizeof(struct uring));
+    r->sq_entries = 1;
+    while (r->sq_entries < entries)
+        r->sq_entries <<= 1;
+    r->cq_entries = r->sq_entries * 2;
+    r->sq_head = r->cq_tail = 0;
+
+    u64 size = cqes_off(r) + r->cq_entries * sizeof(struct uring_cqe);
+    r->npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (usize i = 0; i < r->npages; i++) {
+        r->pages[i] = kalloc_page();
+        memset(r->pages[i], 0, PAGE_SIZE);
+    }
+
+    struct uring_shared *sh = r->pages[0];
+    sh->sq.mask = r->sq_entries - 1;
+    sh->sq.entries = r->sq_entries;
+    sh->cq.mask = r->cq_entries - 1;
+    sh->cq.entries = r->cq_entries;
+    sh->sqes_off = SQES_OFF;
+    sh->cqes_off = cqes_off(r);
+
+    u64 addr = map_kernel_pages(r->pages, r->npages);
+    if (addr == MAP_FAILED) {
+        uring_free_ring(r);
+        return (u64)-1;
+    }
+    p->uring = r;
+    return addr;
+}
+
+// 执行一个提交项；需要完整陷入现场的调用（fork）与环本身的调用不允许在环中执行
+static i64 uring_call(struct uring_sqe *sqe)
+{
+    u64 id = sqe->opcode;
+    if (id >= NR_SYSCALL || syscall_table[id] == NULL || id == SYS_fork ||
+        id == SYS_uring_setup || id == SYS_uring_enter)
+        return -1;
+
+    u64 (*func)(u64, u64, u64, u64, u64, u64) = syscall_table[id];
+    return (i64)func(sqe->args[0], sqe->args[1], sqe->args[2], sqe->args[3],
+                     sqe->args[4], sqe->args[5]);
+}
+
+// 依次执行至多to_submit个提交项，结果写进完成环；完成环满了就停下
+// 返回实际执行的个数，当前进程没有环时返回-1
+i64 uring_enter(u64 to_submit)
+{
+    Proc *p = thisproc();
+    struct uring *r = p->uring;
+    if (r == NULL)
+        return -1;
+
+    struct uring_shared *sh = r->pages[0];
+    struct uring_cqe *cqe;
+    u32 sq_tail = __atomic_load_n(&sh->sq.tail, __ATOMIC_ACQUIRE);
+    i64 done = 0;
+
+    while ((u64)done < to_submit && r->sq_head != sq_tail) {
+        u32 cq_head = __atomic_load_n(&sh->cq.head, __ATOMIC_ACQUIRE);
+        if (r->cq_tail - cq_head >= r->cq_entries)
+            break;
+
+        // 先复制出来，进程可能同时改写共享页
+        struct uring_sqe sqe = *(struct uring_sqe *)ring_at(
+                r, SQES_OFF + (r->sq_head & (r->sq_entries - 1)) *
+                                      sizeof(struct uring_sqe));
+        r->sq_head++;
+        __atomic_store_n(&sh->sq.head, r->sq_head, __ATOMIC_RELEASE);
+
+        i64 res = uring_call(&sqe);
+
+        cqe = ring_at(r, cqes_off(r) + (r->cq_tail & (r->cq_entries - 1)) *
+                                               sizeof(struct uring_cqe));
+        cqe->user_data = sqe.user_data;
+        cqe->res = res;
+        r->cq_tail++;
+        __atomic_store_n(&sh->cq.tail, r->cq_tail, __ATOMIC_RELEASE);
+        done++;
+
+        if (p->killed)
+            break;
+    }
+    return done;
+}
+
+// 释放进程的环（进程已被回收）；共享页的映射由地址空间自己放弃
+void uring_free(struct Proc *p)
+{
+    if (p->uring == NULL)
+        return;
+    uring_free_ring(p->uring);
+    p->uring = NULL;
+}
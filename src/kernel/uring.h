@@ -0,0 +1,43 @@
+#pragma once
+
+#include <common/defines.h>
+
+// 系统调用提交/完成环：进程把若干系统调用写进提交环，一次uring_enter批量执行，
+// 结果写进完成环，陷入内核的开销由一批调用分摊
+// 环所在的页同时映射在进程与内核中，布局为：
+//   struct uring_shared | sqes[sq_entries] | cqes[cq_entries]
+// 提交环由进程写tail、内核写head；完成环由内核写tail、进程写head
+// 写入者先写表项，再以release语义更新tail；读取者以acquire语义读tail
+
+#define URING_MAX_ENTRIES 256
+
+// 一次系统调用：opcode为系统调用号，参数与svc相同
+struct uring_sqe {
+    u64 opcode;
+    u64 args[6];
+    u64 user_data; // 原样带回完成项
+};
+
+struct uring_cqe {
+    u64 user_data;
+    i64 res; // 系统调用的返回值；不允许在环中执行的调用为-1
+};
+
+struct uring_queue {
+    u32 head;
+    u32 tail;
+    u32 mask; // 表项数减一
+    u32 entries;
+};
+
+struct uring_shared {
+    struct uring_queue sq, cq;
+    u64 sqes_off; // 提交项数组相对于环起始的偏移
+    u64 cqes_off; // 完成项数组相对于环起始的偏移
+};
+
+struct Proc;
+
+u64 uring_setup(u64 entries);
+i64 uring_enter(u64 to_submit);
+void uring_free(struct Proc *p);
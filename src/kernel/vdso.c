@@ -0,0 +1,27 @@
+#include <kernel/vdso.h>
+#include <aarch64/mmu.h>
+#include <aarch64/intrinsic.h>
+
+// 所有进程共享的一页，位于内核镜像中，不归分配器管理，因此从不被释放
+static union {
+    struct vdso_data data;
+    u8 page[PAGE_SIZE];
+} vdso __attribute__((aligned(PAGE_SIZE)));
+
+#define VDSO_SHIFT 32
+
+void init_vdso()
+{
+    u64 freq = get_clock_frequency();
+    write_seqcount_begin(&vdso.data.seq);
+    vdso.data.freq = freq;
+    vdso.data.shift = VDSO_SHIFT;
+    vdso.data.mult = (1000000000ULL << VDSO_SHIFT) / freq;
+    write_seqcount_end(&vdso.data.seq);
+}
+
+// 返回数据页的内核地址
+u64 vdso_page()
+{
+    return (u64)&vdso;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/seqlock.h>
+
+// 映射到每个用户地址空间USER_VDSO_BASE处的只读数据页
+// 用户程序直接读CNTVCT_EL0，再换算成纳秒，不需要陷入内核：
+//     ns = ((u128)cntvct * mult) >> shift
+// 校准参数由seq保护（见common/seqlock.h）：seq为奇数或前后不一致时重读
+struct vdso_data {
+    SeqCount seq;
+    u64 freq;  // 计数器频率（Hz）
+    u64 mult;  // 计数值到纳秒的乘数
+    u64 shift; // 计数值到纳秒的移位
+};
+
+void init_vdso();
+u64 vdso_page();
@@ -8,12 +8,17 @@
 #include <kernel/sched.h>
 #include <driver/interrupt.h>
 #include <kernel/proc.h>
+#include <kernel/pt.h>
+#include <kernel/fpsimd.h>
+#include <kernel/vdso.h>
 #include <driver/gicv3.h>
 #include <driver/timer.h>
+#include <driver/fdt.h>
+#include <driver/memlayout.h>
 
 static volatile bool boot_secondary_cpus = false;
 
-void main()
+void main(u64 fdt)
 {
     if (cpuid() == 0) {
         /* @todo: Clear BSS section.*/
@@ -31,8 +36,25 @@ void main()
 
         init_clock_handler();
 
+        /* fill in the time data page shared with user space */
+        init_vdso();
+
+        /* trap the first FP/SIMD use of each user time slice */
+        init_fpsimd_percpu();
+
         /* initialize kernel memory allocator */
-        kinit();
+        u64 memtop = fdt_memory_end(fdt);
+        if (memtop <= EXTMEM)
+            memtop = PHYSTOP;
+        kinit(memtop);
+
+        /* initialize page table management */
+        init_pt();
+
+        /* build the kernel linear map, then hand the rest of RAM to the allocator */
+        init_kernel_pt(memtop);
+        kinit_highmem();
+        printk("RAM: %llu MB\n", (memtop - EXTMEM) >> 20);
 
         /* initialize sched */
         init_sched();
@@ -50,7 +72,9 @@ void main()
         while (!boot_secondary_cpus)
             ;
         arch_fence();
+        load_kernel_pt();
         gicv3_init_percpu();
+        init_fpsimd_percpu();
 
         /* @todo: Print "Hello, world! (Core <core id>)" */
         printk("Hello, world! (Core %llu)\n", cpuid());
@@ -0,0 +1,70 @@
+#include <kernel/sched.h>
+#include <kernel/proc.h>
+#include <kernel/printk.h>
+#include <common/sem.h>
+#include <aarch64/intrinsic.h>
+#include <test/test.h>
+
+void set_parent_to_this(Proc *proc);
+
+// 两个进程经由一对信号量来回交接：ping唤醒pong，pong再唤醒ping
+// 每一轮包含两次交接（即两次唤醒与两次上下文切换）
+#define ROUNDS 10000
+
+static Semaphore ping, pong;
+
+static void bench_ping(u64 rounds)
+{
+    for (u64 i = 0; i < rounds; i++) {
+        post_sem(&ping);
+        wait_sem(&pong);
+    }
+    exit(0);
+}
+
+static void bench_pong(u64 rounds)
+{
+    for (u64 i = 0; i < rounds; i++) {
+        wait_sem(&ping);
+        post_sem(&pong);
+    }
+    exit(0);
+}
+
+// 让两个进程分别绑定在cpu_a、cpu_b上交接，返回每次交接的平均时钟周期数
+static u64 ping_pong(int cpu_a, int cpu_b)
+{
+    init_sem(&ping, 0);
+    init_sem(&pong, 0);
+
+    Proc *a = create_proc(), *b = create_proc();
+    a->schinfo.cpu = cpu_a;
+    b->schinfo.cpu = cpu_b;
+    set_parent_to_this(a);
+    set_parent_to_this(b);
+
+    u64 start = get_timestamp();
+    start_proc(b, bench_pong, ROUNDS);
+    start_proc(a, bench_ping, ROUNDS);
+    int code;
+    wait(&code);
+    wait(&code);
+    u64 end = get_timestamp();
+
+    return (end - start) / (2 * ROUNDS);
+}
+
+// 上下文切换延迟：同一CPU上的交接只是两次切换，
+// 跨CPU时还要等对方CPU从idle中醒来（没有IPI，最坏要等到下一次时钟中断）
+void sched_bench()
+{
+    printk("sched_bench\n");
+    u64 freq = get_clock_frequency();
+    u64 same = ping_pong(1, 1);
+    u64 cross = ping_pong(1, 2);
+    printk("handoff on one CPU: %llu ticks (%llu ns)\n", same,
+           same * 1000000000 / freq);
+    printk("handoff across CPUs: %llu ticks (%llu ns)\n", cross,
+           cross * 1000000000 / freq);
+    printk("sched_bench PASS\n");
+}
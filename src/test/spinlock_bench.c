@@ -0,0 +1,109 @@
+#include <kernel/sched.h>
+#include <kernel/proc.h>
+#include <kernel/printk.h>
+#include <kernel/cpu.h>
+#include <common/spinlock.h>
+#include <aarch64/intrinsic.h>
+#include <test/test.h>
+
+void set_parent_to_this(Proc *proc);
+
+// 原来的test-and-set锁，作为对照
+typedef struct {
+    volatile bool locked;
+} TasLock;
+
+static void tas_acquire(void *l)
+{
+    TasLock *lock = l;
+    while (lock->locked ||
+           __atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE))
+        arch_yield();
+}
+
+static void tas_release(void *l)
+{
+    __atomic_clear(&((TasLock *)l)->locked, __ATOMIC_RELEASE);
+}
+
+static void mcs_acquire(void *l)
+{
+    acquire_spinlock(l);
+}
+
+static void mcs_release(void *l)
+{
+    release_spinlock(l);
+}
+
+#define ITERS 20000
+
+static struct {
+    void (*acquire)(void *);
+    void (*release)(void *);
+    void *lock;
+} cur;
+static int contenders, ready;
+static u64 counter, elapsed[NCPU];
+
+// 每个CPU上一个进程：到齐后一起开始，反复获取锁、累加计数器、释放锁
+static void bench_worker(u64 id)
+{
+    __atomic_fetch_add(&ready, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) < contenders)
+        arch_yield();
+
+    u64 start = get_timestamp();
+    for (int i = 0; i < ITERS; i++) {
+        cur.acquire(cur.lock);
+        counter++;
+        cur.release(cur.lock);
+    }
+    elapsed[id] = get_timestamp() - start;
+    exit(0);
+}
+
+// 让n个CPU争用同一把锁，返回每次获取+释放的平均计数（以最慢的CPU计）
+static u64 contend(int n)
+{
+    contenders = n;
+    ready = 0;
+    counter = 0;
+    for (int i = 0; i < n; i++) {
+        Proc *p = create_proc();
+        p->schinfo.cpu = i;
+        set_parent_to_this(p);
+        start_proc(p, bench_worker, i);
+    }
+    u64 slowest = 0;
+    for (int i = 0; i < n; i++) {
+        int code;
+        wait(&code);
+    }
+    for (int i = 0; i < n; i++)
+        slowest = MAX(slowest, elapsed[i]);
+    ASSERT(counter == (u64)n * ITERS);
+    return slowest / ITERS;
+}
+
+// 1~NCPU个CPU争用时，test-and-set锁与MCS锁的单次临界区开销
+void spinlock_bench()
+{
+    printk("spinlock_bench\n");
+    static TasLock tas;
+    static SpinLock mcs;
+    init_spinlock(&mcs);
+
+    for (int n = 1; n <= NCPU; n++) {
+        cur.acquire = tas_acquire;
+        cur.release = tas_release;
+        cur.lock = &tas;
+        u64 t = contend(n);
+        cur.acquire = mcs_acquire;
+        cur.release = mcs_release;
+        cur.lock = &mcs;
+        u64 m = contend(n);
+        printk("%d CPU(s): tas %llu ticks, mcs %llu ticks\n", n, t, m);
+    }
+    printk("spinlock_bench PASS\n");
+}
@@ -7,7 +7,10 @@ void kalloc_test();
 void rbtree_test();
 void proc_test();
 void vm_test();
+void vm_range_test();
 void user_proc_test();
+void sched_bench();
+void spinlock_bench();
 unsigned rand();
 void srand(unsigned seed);
 
@@ -8,6 +8,7 @@
 #include <kernel/syscall.h>
 #include <driver/memlayout.h>
 #include <kernel/sched.h>
+#include <kernel/systrace.h>
 
 PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
 
@@ -38,6 +39,79 @@ void vm_test()
     printk("vm_test PASS\n");
 }
 
+// map_range/unmap_range：逐页映射的页由unmap_range放弃引用；
+// 块映射的内存由调用者管理，部分解除映射会拆分块，但拆出的页不被释放
+void vm_range_test()
+{
+    printk("vm_range_test\n");
+    static void *p[100000];
+    extern RefCount kalloc_page_cnt;
+    struct pgdir pg;
+    int p0 = kalloc_page_cnt.count;
+    init_pgdir(&pg);
+    for (u64 i = 0; i < 100000; i++) {
+        p[i] = kalloc_page();
+        map_range(&pg, i << 12, K2P(p[i]), PAGE_SIZE, PTE_USER_DATA);
+        *(int *)p[i] = i;
+    }
+
+    // 两个2MB块，物理内存多半落在上面分配的页中
+    u64 bva = 0x80000000, bpa = round_up(K2P(p[50000]), L2_BLOCK_SIZE);
+    map_range(&pg, bva, bpa, 2 * L2_BLOCK_SIZE, PTE_USER_DATA);
+    ASSERT(PTE_IS_BLOCK(*get_pte(&pg, bva, false)));
+
+    attach_pgdir(&pg);
+    for (u64 i = 0; i < 100000; i++) {
+        ASSERT(*(int *)(P2K(PTE_ADDRESS(*get_pte(&pg, i << 12, false)))) ==
+               (int)i);
+        ASSERT(*(int *)(i << 12) == (int)i);
+    }
+    for (u64 off = 0; off < 2 * L2_BLOCK_SIZE; off += 0x10000)
+        ASSERT(*(u64 *)(bva + off) == *(u64 *)P2K(bpa + off));
+
+    // 在第一个块中间挖掉一页：块被拆分，其余的页照常可访问
+    int p1 = kalloc_page_cnt.count;
+    unmap_range(&pg, bva + PAGE_SIZE, PAGE_SIZE);
+    ASSERT(!(*get_pte(&pg, bva + PAGE_SIZE, false) & PTE_VALID));
+    ASSERT(*get_pte(&pg, bva, false) & PTE_NOREF);
+    ASSERT(*(u64 *)(bva + 2 * PAGE_SIZE) == *(u64 *)P2K(bpa + 2 * PAGE_SIZE));
+    ASSERT(kalloc_page_cnt.count == p1 + 1); // 拆分只多用了一页页表
+
+    // 一次map_range映射一段连续的页，跨过2MB（也是1GB）边界，换用另一张最后一级页表；
+    // 与逐页用get_pte填写的页表逐项比较，并逐页检查内容
+    // 物理页取自内核镜像中的数组p，不归分配器管理，解除映射时不会被释放
+    const u64 n = 128, cva = 0xC0000000 - n / 2 * PAGE_SIZE;
+    u64 cpa = round_up(K2P(p), PAGE_SIZE);
+    ASSERT(cpa + n * PAGE_SIZE <= K2P(p + 100000));
+    struct pgdir ref;
+    init_pgdir(&ref);
+    map_range(&pg, cva, cpa, n * PAGE_SIZE, PTE_USER_DATA);
+    for (u64 i = 0; i < n; i++)
+        *get_pte(&ref, cva + i * PAGE_SIZE, true) =
+                (cpa + i * PAGE_SIZE) | PTE_USER_DATA;
+    for (u64 i = 0; i < n; i++) {
+        u64 va = cva + i * PAGE_SIZE;
+        ASSERT(*get_pte(&pg, va, false) == *get_pte(&ref, va, false));
+        ASSERT(*(u64 *)(va + 8 * i) ==
+               *(u64 *)P2K(cpa + i * PAGE_SIZE + 8 * i));
+    }
+    ASSERT(!(*get_pte(&pg, cva - PAGE_SIZE, false) & PTE_VALID));
+    ASSERT(!(*get_pte(&pg, cva + n * PAGE_SIZE, false) & PTE_VALID));
+    free_pgdir(&ref);
+    unmap_range(&pg, cva, n * PAGE_SIZE);
+    for (u64 i = 0; i < n; i++)
+        ASSERT(!(*get_pte(&pg, cva + i * PAGE_SIZE, false) & PTE_VALID));
+
+    unmap_range(&pg, 0, 100000 << 12);
+    unmap_range(&pg, bva, 2 * L2_BLOCK_SIZE);
+    for (u64 i = 0; i < 100000; i += 1000)
+        ASSERT(!(*get_pte(&pg, i << 12, false) & PTE_VALID));
+    free_pgdir(&pg);
+    attach_pgdir(&pg);
+    ASSERT(kalloc_page_cnt.count == p0);
+    printk("vm_range_test PASS\n");
+}
+
 void trap_return(u64);
 
 static u64 proc_cnt[22] = { 0 }, cpu_cnt[4] = { 0 };
@@ -62,6 +136,9 @@ void user_proc_test()
 {
     printk("user_proc_test\n");
     init_sem(&myrepot_done, 0);
+    systrace_stats_reset();
+    systrace_stats_enable(true);
+    Proc *traced = NULL;
     extern char loop_start[], loop_end[];
     int pids[22];
     for (int i = 0; i < 22; i++) {
@@ -72,11 +149,15 @@ void user_proc_test()
         }
         ASSERT(p->pgdir.pt);
 
-        // TODO: setup the user context
-        // 1. set x0 = i
-        // 2. set elr = EXTMEM
-        // 3. set spsr = 0
+        // 用户态从EXTMEM处的loop_start开始执行，x0为进程编号，SPSR为0即EL0t
+        p->ucontext->x0 = i;
+        p->ucontext->elr = EXTMEM;
+        p->ucontext->spsr = 0;
 
+        if (i == 0) {
+            traced = p;
+            systrace_proc_enable(p, true);
+        }
         pids[i] = start_proc(p, trap_return, 0);
         printk("pid[%d] = %d\n", i, pids[i]);
     }
@@ -84,6 +165,19 @@ void user_proc_test()
     printk("done\n");
     for (int i = 0; i < 22; i++)
         ASSERT(kill(pids[i]) == 0);
+    systrace_stats_enable(false);
+    systrace_proc_dump(traced);
+
+    // 统计与跟踪确实看到了用户进程的系统调用：
+    // 统计的次数不少于syscall_myreport数到的次数，0号进程的最后一条记录是它自己发出的
+    u64 reported = 0;
+    for (int i = 0; i < 22; i++)
+        reported += proc_cnt[i];
+    ASSERT(systrace_stats_count(SYS_myreport) >= reported);
+    struct syscall_trace *t = traced->strace;
+    ASSERT(t->next >= proc_cnt[0] && t->next > 0);
+    struct syscall_record *last = &t->rec[(t->next - 1) % SYSTRACE_RECORDS];
+    ASSERT(last->id == SYS_myreport && last->args[0] == 0);
     for (int i = 0; i < 22; i++) {
         int code;
         int pid = wait(&code);
@@ -95,4 +189,5 @@ void user_proc_test()
         printk("CPU %d: %llu\n", i, cpu_cnt[i]);
     for (int i = 0; i < 22; i++)
         printk("Proc %d: %llu\n", i, proc_cnt[i]);
+    systrace_stats_dump();
 }